@@ -2,6 +2,10 @@
 #include <cassert>
 #include <iostream>
 #include <optional>
+#include <random>
+#include <algorithm>
+
+#include "indexed_heap.h"
 
 class binary_min_heap
 {
@@ -139,5 +143,62 @@ main ()
     assert (heap.empty ());
   }
 
+  {
+    // Test 6: Indexed d-ary heap, decrease-key moves an item up
+    indexed_dary_heap<int> heap (10);
+    heap.insert (0, 50);
+    heap.insert (1, 30);
+    heap.insert (2, 40);
+    assert (!heap.insert (1, 5));
+    assert (heap.get_min ()->first == 1);
+    assert (heap.decrease_key (2, 10));
+    assert (!heap.decrease_key (2, 20)); // not lower
+    assert (!heap.decrease_key (7, 1));  // not queued
+    assert (heap.get_min ()->first == 2 && heap.get_min ()->second == 10);
+    heap.delete_min ();
+    assert (!heap.contains (2) && heap.contains (0));
+    assert (heap.push_or_decrease (2, 1));
+    assert (heap.get_min ()->first == 2);
+    heap.clear ();
+    assert (heap.empty () && !heap.contains (0) && heap.insert (0, 3));
+  }
+
+  {
+    // Test 7: Random inserts, decreases and deletes against a sorted reference, D = 2, 4 and 8
+    auto check = [] (auto heap) {
+      std::mt19937 rng (5);
+      std::vector<double> key (500, -1.0); // -1 when not queued
+      for (int step = 0; step < 20'000; ++step)
+        {
+          auto item = static_cast<uint32_t> (rng () % key.size ());
+          auto op = rng () % 3;
+          if (op == 0 && key[item] < 0)
+            {
+              key[item] = static_cast<double> (rng () % 1000);
+              assert (heap.insert (item, key[item]));
+            }
+          else if (op == 1 && key[item] >= 0)
+            {
+              auto lower = std::max (0.0, key[item] - static_cast<double> (rng () % 100));
+              assert (heap.decrease_key (item, lower) == (lower < key[item]));
+              key[item] = std::min (key[item], lower);
+            }
+          else if (op == 2 && !heap.empty ())
+            {
+              auto [min_item, min_key] = *heap.get_min ();
+              assert (min_key == *std::min_element (key.begin (), key.end (), [] (double a, double b) {
+                return b < 0 || (a >= 0 && a < b);
+              }));
+              assert (key[min_item] == min_key);
+              key[min_item] = -1.0;
+              heap.delete_min ();
+            }
+        }
+    };
+    check (indexed_dary_heap<double, 2> (500));
+    check (indexed_dary_heap<double, 4> (500));
+    check (indexed_dary_heap<double, 8> (500));
+  }
+
   std::cout << "All tests passed!\n";
 }
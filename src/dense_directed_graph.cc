@@ -1,20 +1,34 @@
 #include <cassert>
 #include <iostream>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include <string>
-#include <queue>
+#include <optional>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <random>
+#include <queue>
+#include <immintrin.h>
+
+#include "graph_traversal.h"
 
 //
 // assumption: you won't be adding/removing vertices because it's freaking expensive.
 // in fact, you need to pass a vector with every vertex created because fuck it
 //
+// the matrix is one 64-byte aligned block of bits, every row padded to a whole number of cache lines so
+// rows can be read 256 bits at a time. visited sets are bitsets of the same width, which means a bfs level
+// (see distances) is just OR-ing the rows of the frontier together and masking the result with ~visited
+//
 class dense_directed_graph final
 {
 public:
   dense_directed_graph (std::vector<std::string> &data)
+    : _n{static_cast<uint32_t> (data.size ())}, _stride{row_words (data.size ())},
+      _matrix{make_bits (size_t{_n} * _stride)}
   {
     _index_to_key.resize (data.size (), std::string ());
     for (uint32_t i = 0; i < data.size (); ++i)
@@ -22,7 +36,6 @@ public:
         _index_to_key[i] = data[i];
         _key_to_index[data[i]] = i;
       }
-    _matrix.resize (data.size (), std::vector<bool> (data.size (), false));
   }
 
   ~dense_directed_graph () = default;
@@ -39,7 +52,7 @@ public:
       }
     auto src_idx = src_it->second;
     auto dst_idx = dst_it->second;
-    _matrix[src_idx][dst_idx] = true;
+    row (src_idx)[dst_idx / 64] |= uint64_t{1} << (dst_idx % 64);
     return true;
   }
 
@@ -55,103 +68,89 @@ public:
       }
     auto src_idx = src_it->second;
     auto dst_idx = dst_it->second;
-    _matrix[src_idx][dst_idx] = false;
+    row (src_idx)[dst_idx / 64] &= ~(uint64_t{1} << (dst_idx % 64));
     return true;
   }
 
-  void dfs_helper (uint32_t vertex, std::unordered_set<uint32_t> &visited) const
+  std::optional<uint32_t> id (std::string const &key) const
   {
-    visited.emplace (vertex);
-    std::cout << _index_to_key.at (vertex) << ' ';
-    for (uint32_t i = 0; i < _matrix[vertex].size (); ++i)
+    auto it = _key_to_index.find (key);
+    if (it == _key_to_index.end ())
       {
-        if (_matrix[vertex][i] && visited.count (i) == 0)
-          {
-            dfs_helper (i, visited);
-          }
+        return std::nullopt;
       }
+    return it->second;
   }
 
-  void dfs () const
+  std::string const &name (uint32_t index) const { return _index_to_key[index]; }
+
+  // depth first over the indices with a graph_visitor (see graph_traversal.h), from every vertex or just root
+  template <typename Visitor> bool for_each_dfs (Visitor &&visitor, uint32_t root = unreached) const
   {
-    std::unordered_set<uint32_t> visited;
-    for (uint32_t i = 0; i < _matrix.size (); ++i)
-      {
-        if (visited.count (i) == 0)
-          {
-            dfs_helper (i, visited);
-          }
-      }
-    std::cout << '\n';
+    traversal_scratch scratch;
+    return ::for_each_dfs (row_view{this}, scratch, visitor, root);
   }
 
-  void bfs () const
+  // plain queue order, distances () is the one that goes a whole level of bitsets at a time
+  template <typename Visitor> bool for_each_bfs (Visitor &&visitor, uint32_t root = unreached) const
   {
-    std::queue<uint32_t> current_vertices;
-    std::unordered_set<uint32_t> visited;
-    for (uint32_t i = 0; i < _matrix.size (); ++i)
-      {
-        if (visited.count (i) == 0)
-          {
-            visited.emplace (i);
-            current_vertices.emplace (i);
-            while (!current_vertices.empty ())
-              {
-                auto curr = current_vertices.front ();
-                current_vertices.pop ();
-                std::cout << _index_to_key.at (curr) << ' ';
-                for (uint32_t j = 0; j < _matrix.size (); ++j)
-                  {
-                    if (_matrix[curr][j] && visited.count (j) == 0)
-                      {
-                        current_vertices.emplace (j);
-                        visited.emplace (j);
-                      }
-                  }
-              }
-          }
-      }
-    std::cout << '\n';
+    traversal_scratch scratch;
+    return ::for_each_bfs (row_view{this}, scratch, visitor, root);
   }
 
-  bool has_cycle_helper (uint32_t vertex, std::unordered_set<uint32_t> &visited,
-                         std::unordered_set<uint32_t> &path) const
+  // hop count from src to every vertex, ~0u for the unreachable ones
+  std::vector<uint32_t> distances (std::string const &src) const
   {
-    path.emplace (vertex);
-    visited.emplace (vertex);
-    for (uint32_t i = 0; i < _matrix[vertex].size (); ++i)
+    std::vector<uint32_t> result (_n, ~0u);
+    auto it = _key_to_index.find (src);
+    if (it == _key_to_index.end ())
       {
-        if (_matrix[vertex][i] && visited.count (i) == 0)
-          {
-            if (has_cycle_helper (i, visited, path))
-              {
-                return true;
-              }
-          }
-        else if (_matrix[vertex][i] && path.count (i) > 0)
-          {
-            return true;
-          }
+        return result;
       }
-    path.erase (vertex);
-    return false;
+
+    auto visited = make_bits (_stride);
+    auto frontier = make_bits (_stride);
+    auto next = make_bits (_stride);
+    uint32_t level = 0;
+
+    set (visited.get (), it->second);
+    set (frontier.get (), it->second);
+    do
+      {
+        for_each_bit (frontier.get (), [&result, level] (uint32_t v) { result[v] = level; });
+        ++level;
+      }
+    while (expand (frontier, next, visited.get ()));
+    return result;
+  }
+
+  // distance and parent of every index from src. in edges come from scanning a column, one bit per row
+  bfs_result bfs_tree (std::string const &src, bfs_options const &options = {}) const
+  {
+    auto it = _key_to_index.find (src);
+    return direction_optimizing_bfs (row_view{this}, column_view{this}, it == _key_to_index.end () ? _n : it->second,
+                                     options);
   }
 
   bool has_cycle () const
   {
-    std::unordered_set<uint32_t> visited;
-    std::unordered_set<uint32_t> path;
-    for (uint32_t i = 0; i < _matrix.size (); ++i)
+    traversal_scratch scratch;
+    std::vector<uint32_t> cycle;
+    return find_cycle<true> (row_view{this}, scratch, cycle);
+  }
+
+  // the keys of some cycle in edge order (the last one points back at the first), empty if there's none
+  std::vector<std::string> cycle () const
+  {
+    traversal_scratch scratch;
+    std::vector<uint32_t> ids;
+    find_cycle<true> (row_view{this}, scratch, ids);
+    std::vector<std::string> keys;
+    for (auto v : ids)
       {
-        if (visited.count (i) == 0)
-          {
-            if (has_cycle_helper (i, visited, path))
-              {
-                return true;
-              }
-          }
+        keys.push_back (_index_to_key[v]);
       }
-    return false;
+    return keys;
   }
 
   bool has_edge (std::string const &src, std::string const &dst) const
@@ -166,16 +165,193 @@ public:
       }
     auto src_idx = src_it->second;
     auto dst_idx = dst_it->second;
-    return _matrix[src_idx][dst_idx];
+    return test (row (src_idx), dst_idx);
   }
 
 private:
-  std::vector<std::vector<bool>> _matrix;
+  struct free_deleter
+  {
+    void operator() (uint64_t *p) const { std::free (p); }
+  };
+
+  using bits = std::unique_ptr<uint64_t[], free_deleter>;
+
+  static size_t row_words (size_t n) { return (n + 511) / 512 * 8; }
+
+  static bits make_bits (size_t words)
+  {
+    auto bytes = std::max<size_t> (words, 8) * sizeof (uint64_t);
+    auto *p = static_cast<uint64_t *> (std::aligned_alloc (64, bytes));
+    if (p == nullptr)
+      {
+        throw std::bad_alloc ();
+      }
+    std::memset (p, 0, bytes);
+    return bits (p);
+  }
+
+  static bool test (uint64_t const *b, uint32_t i) { return (b[i / 64] >> (i % 64)) & 1; }
+  static void set (uint64_t *b, uint32_t i) { b[i / 64] |= uint64_t{1} << (i % 64); }
+
+  uint64_t *row (uint32_t i) { return _matrix.get () + size_t{i} * _stride; }
+  uint64_t const *row (uint32_t i) const { return _matrix.get () + size_t{i} * _stride; }
+
+  template <typename Visit>
+  void for_each_bit (uint64_t const *b, Visit &&visit) const
+  {
+    for (size_t w = 0; w < _stride; ++w)
+      {
+        for (auto word = b[w]; word != 0; word &= word - 1)
+          {
+            visit (static_cast<uint32_t> (w * 64 + __builtin_ctzll (word)));
+          }
+      }
+  }
+
+  struct row_view
+  {
+    dense_directed_graph const *_g;
+
+    uint32_t vertex_count () const { return _g->_n; }
+
+    uint64_t degree (uint32_t v) const
+    {
+      uint64_t count = 0;
+      for (size_t w = 0; w < _g->_stride; ++w)
+        {
+          count += __builtin_popcountll (_g->row (v)[w]);
+        }
+      return count;
+    }
+
+    template <typename Edge> void for_each_edge (uint32_t v, Edge &&edge) const
+    {
+      auto const *r = _g->row (v);
+      for (size_t w = 0; w < _g->_stride; ++w)
+        {
+          for (auto word = r[w]; word != 0; word &= word - 1)
+            {
+              if (edge (static_cast<uint32_t> (w * 64 + __builtin_ctzll (word))))
+                {
+                  return;
+                }
+            }
+        }
+    }
+
+    bool has_vertex (uint32_t) const { return true; }
+
+    uint64_t first_edge (uint32_t) const { return 0; }
+
+    // the cursor is the first column not looked at yet
+    bool next_edge (uint32_t v, uint64_t &cursor, uint32_t &target) const
+    {
+      auto const *r = _g->row (v);
+      for (auto w = cursor / 64; w < _g->_stride; ++w)
+        {
+          auto word = r[w];
+          if (w == cursor / 64)
+            {
+              word &= ~uint64_t{0} << (cursor % 64);
+            }
+          if (word != 0)
+            {
+              target = static_cast<uint32_t> (w * 64 + __builtin_ctzll (word));
+              cursor = target + uint64_t{1};
+              return true;
+            }
+        }
+      return false;
+    }
+  };
+
+  struct column_view
+  {
+    dense_directed_graph const *_g;
+
+    uint32_t vertex_count () const { return _g->_n; }
+
+    uint64_t degree (uint32_t v) const
+    {
+      uint64_t count = 0;
+      for (uint32_t u = 0; u < _g->_n; ++u)
+        {
+          count += test (_g->row (u), v);
+        }
+      return count;
+    }
+
+    template <typename Edge> void for_each_edge (uint32_t v, Edge &&edge) const
+    {
+      for (uint32_t u = 0; u < _g->_n; ++u)
+        {
+          if (test (_g->row (u), v) && edge (u))
+            {
+              return;
+            }
+        }
+    }
+  };
+
+  // next = (OR of the frontier's rows) & ~visited, then it becomes the frontier. false once nothing is new
+  bool expand (bits &frontier, bits &next, uint64_t *visited) const
+  {
+    std::memset (next.get (), 0, _stride * sizeof (uint64_t));
+    for_each_bit (frontier.get (), [this, &next] (uint32_t v) {
+      auto const *r = row (v);
+      for (size_t w = 0; w < _stride; w += 4)
+        {
+          auto acc = _mm256_load_si256 (reinterpret_cast<__m256i const *> (next.get () + w));
+          auto add = _mm256_load_si256 (reinterpret_cast<__m256i const *> (r + w));
+          _mm256_store_si256 (reinterpret_cast<__m256i *> (next.get () + w), _mm256_or_si256 (acc, add));
+        }
+    });
+
+    auto any = _mm256_setzero_si256 ();
+    for (size_t w = 0; w < _stride; w += 4)
+      {
+        auto *np = reinterpret_cast<__m256i *> (next.get () + w);
+        auto *vp = reinterpret_cast<__m256i *> (visited + w);
+        auto fresh = _mm256_andnot_si256 (_mm256_load_si256 (vp), _mm256_load_si256 (np));
+        _mm256_store_si256 (np, fresh);
+        _mm256_store_si256 (vp, _mm256_or_si256 (_mm256_load_si256 (vp), fresh));
+        any = _mm256_or_si256 (any, fresh);
+      }
+    std::swap (frontier, next);
+    return !_mm256_testz_si256 (any, any);
+  }
+
+  uint32_t _n;
+  size_t _stride; // words per row, always a multiple of 8 so every row starts on a cache line
+  bits _matrix;
   std::vector<std::string> _index_to_key;
   std::unordered_map<std::string, uint32_t> _key_to_index;
-  uint32_t _index;
 };
 
+template <typename Graph>
+std::vector<std::string>
+dfs_order (Graph const &graph)
+{
+  std::vector<std::string> order;
+  graph.for_each_dfs (on_discover ([&] (uint32_t v) {
+    order.push_back (graph.name (v));
+    return false;
+  }));
+  return order;
+}
+
+template <typename Graph>
+std::vector<std::string>
+bfs_order (Graph const &graph)
+{
+  std::vector<std::string> order;
+  graph.for_each_bfs (on_discover ([&] (uint32_t v) {
+    order.push_back (graph.name (v));
+    return false;
+  }));
+  return order;
+}
+
 int
 main ()
 {
@@ -232,9 +408,11 @@ main ()
     g.add_edge ("G"s, "E"s); // Creates a cycle E -> F -> G -> E
 
     assert (g.has_cycle ());
+    assert ((g.cycle () == std::vector<std::string>{"E"s, "F"s, "G"s}));
 
     g.remove_edge ("E"s, "F"s); // resulting in F -> G -> E
     assert (!g.has_cycle ());
+    assert (g.cycle ().empty ());
   }
 
   // Test 5: Large graph with multiple connected components
@@ -286,8 +464,8 @@ main ()
     g.add_edge ("V"s, "W"s);
     g.add_edge ("W"s, "T"s); // Creates a cycle T -> U -> V -> W -> T
 
-    g.dfs (); // T U V W
-    g.bfs (); // T U V W
+    assert ((dfs_order (g) == std::vector<std::string>{"T"s, "U"s, "V"s, "W"s}));
+    assert ((bfs_order (g) == std::vector<std::string>{"T"s, "U"s, "V"s, "W"s}));
   }
 
   {
@@ -300,8 +478,76 @@ main ()
     g.add_edge ("U"s, "V"s);
     g.add_edge ("V"s, "W"s);
 
-    g.dfs (); // This should be: T U V W Z
-    g.bfs (); // This should be: T U Z V W
+    assert ((dfs_order (g) == std::vector<std::string>{"T"s, "U"s, "V"s, "W"s, "Z"s}));
+    assert ((bfs_order (g) == std::vector<std::string>{"T"s, "U"s, "Z"s, "V"s, "W"s}));
+  }
+
+  {
+    // Self loop is a cycle, and distances skip what isn't reachable
+    std::vector<std::string> vertices = {"A"s, "B"s, "C"s};
+    dense_directed_graph g (vertices);
+    g.add_edge ("A"s, "B"s);
+    assert (!g.has_cycle ());
+    auto d = g.distances ("A"s);
+    assert (d[0] == 0 && d[1] == 1 && d[2] == ~0u);
+    g.add_edge ("C"s, "C"s);
+    assert (g.has_cycle ());
+    auto tree = g.bfs_tree ("A"s);
+    assert (tree._distance == d);
+    assert (tree._parent[1] == 0 && tree._parent[2] == unreached);
+  }
+
+  {
+    // Rows spanning several cache lines, checked against a plain queue bfs and a recursive-free dfs
+    uint32_t constexpr n = 3000;
+    std::vector<std::string> vertices;
+    for (uint32_t i = 0; i < n; ++i)
+      {
+        vertices.emplace_back ("V" + std::to_string (i));
+      }
+    dense_directed_graph g (vertices);
+    std::vector<std::vector<uint32_t>> list (n);
+    std::mt19937 rng (42);
+    for (uint32_t e = 0; e < 4 * n; ++e)
+      {
+        auto a = rng () % n;
+        auto b = rng () % n;
+        if (a < b) // forward edges only, so it stays acyclic
+          {
+            g.add_edge (vertices[a], vertices[b]);
+            list[a].push_back (b);
+          }
+      }
+    assert (!g.has_cycle ());
+
+    std::vector<uint32_t> expected (n, ~0u);
+    std::queue<uint32_t> q;
+    expected[0] = 0;
+    q.push (0);
+    while (!q.empty ())
+      {
+        auto v = q.front ();
+        q.pop ();
+        for (auto w : list[v])
+          {
+            if (expected[w] == ~0u)
+              {
+                expected[w] = expected[v] + 1;
+                q.push (w);
+              }
+          }
+      }
+    assert (g.distances ("V0"s) == expected);
+    for (bool direction_optimizing : {false, true})
+      {
+        bfs_options options;
+        options._threads = 3;
+        options._direction_optimizing = direction_optimizing;
+        assert (g.bfs_tree ("V0"s, options)._distance == expected);
+      }
+
+    g.add_edge ("V2999"s, "V0"s);
+    assert (g.has_cycle () == (expected[n - 1] != ~0u));
   }
 
   std::cout << "All tests passed!\n";
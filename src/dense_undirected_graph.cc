@@ -1,25 +1,33 @@
 #include <cstdlib>
 #include <cassert>
 #include <string>
+#include <optional>
 #include <vector>
-#include <map>
-#include <set>
+#include <functional>
+#include <cstdint>
+#include <utility>
+#include <random>
+
+#include "graph_traversal.h"
 #include <iostream>
-#include <queue>
 #include <limits>
 
+//
+// only the upper triangle (diagonal included) is stored, packed row after row into one bitset: row i holds
+// the bits for (i, i), (i, i + 1), ... (i, n - 1). an edge is a single bit, so a 50k vertex graph fits in
+// ~150MB instead of 20GB. keys live once in _index_to_key, the key -> index table is a flat open
+// addressing array of indices into it
+//
 class dense_undirected_graph final
 {
 public:
-  dense_undirected_graph (std::vector<std::string> &vertices) : _index{0}
+  dense_undirected_graph (std::vector<std::string> &vertices)
+    : _n{vertices.size ()}, _index_to_key (vertices), _slots (table_size (vertices.size ()), _no_slot),
+      _matrix ((_n * (_n + 1) / 2 + 63) / 64 + 1, 0) // one spare word so reads 64 bits ahead never fall off
   {
-    _matrix.resize (vertices.size (), std::vector<size_t> (vertices.size (), 0));
-
-    for (auto const &vertex : vertices)
+    for (size_t i = 0; i < _n; ++i)
       {
-        _key_to_index[vertex] = _index;
-        _index_to_key[_index] = vertex;
-        ++_index;
+        _slots[find_slot (_index_to_key[i])] = static_cast<uint32_t> (i);
       }
   }
 
@@ -30,16 +38,17 @@ public:
     assert (!src.empty ());
     assert (!dst.empty ());
 
-    if (_key_to_index.count (src) == 0 || _key_to_index.count (dst) == 0)
+    auto src_index = index_of (src);
+    auto dst_index = index_of (dst);
+
+    if (src_index == _n || dst_index == _n)
       {
         return false;
       }
 
-    auto src_index = _key_to_index[src];
-    auto dst_index = _key_to_index[dst];
+    auto bit = position (src_index, dst_index);
 
-    _matrix[src_index][dst_index] = 1;
-    _matrix[dst_index][src_index] = 1;
+    _matrix[bit / 64] |= uint64_t{1} << (bit % 64);
 
     return true;
   }
@@ -49,16 +58,17 @@ public:
     assert (!src.empty ());
     assert (!dst.empty ());
 
-    if (_key_to_index.count (src) == 0 || _key_to_index.count (dst) == 0)
+    auto src_index = index_of (src);
+    auto dst_index = index_of (dst);
+
+    if (src_index == _n || dst_index == _n)
       {
         return false;
       }
 
-    auto src_index = _key_to_index[src];
-    auto dst_index = _key_to_index[dst];
+    auto bit = position (src_index, dst_index);
 
-    _matrix[src_index][dst_index] = 0;
-    _matrix[dst_index][src_index] = 0;
+    _matrix[bit / 64] &= ~(uint64_t{1} << (bit % 64));
 
     return true;
   }
@@ -68,138 +78,258 @@ public:
     assert (!src.empty ());
     assert (!dst.empty ());
 
-    if (_key_to_index.count (src) == 0 || _key_to_index.count (dst) == 0)
+    auto src_index = index_of (src);
+    auto dst_index = index_of (dst);
+
+    if (src_index == _n || dst_index == _n)
       {
         return false;
       }
 
-    auto src_index = _key_to_index.at (src);
-    auto dst_index = _key_to_index.at (dst);
+    return edge (src_index, dst_index);
+  }
+
+  std::optional<uint32_t> id (std::string const &key) const
+  {
+    auto index = index_of (key);
+
+    if (index == _n)
+      {
+        return std::nullopt;
+      }
+
+    return static_cast<uint32_t> (index);
+  }
+
+  std::string const &name (uint32_t index) const { return _index_to_key[index]; }
+
+  // depth first over the indices with a graph_visitor (see graph_traversal.h), from every vertex or just root
+  template <typename Visitor> bool for_each_dfs (Visitor &&visitor, uint32_t root = unreached) const
+  {
+    traversal_scratch scratch;
 
-    return _matrix[src_index][dst_index] == 1;
+    return ::for_each_dfs (neighbour_view{this}, scratch, visitor, root);
   }
 
-  void dfs_helper (size_t vertex, std::set<size_t> &visited) const
+  template <typename Visitor> bool for_each_bfs (Visitor &&visitor, uint32_t root = unreached) const
   {
-    visited.emplace (vertex);
+    traversal_scratch scratch;
 
-    std::cout << _index_to_key.at (vertex) << ' ';
+    return ::for_each_bfs (neighbour_view{this}, scratch, visitor, root);
+  }
+
+  // a self edge counts as a cycle, same as any visited neighbour that isn't the one we came from
+  bool has_cycle () const
+  {
+    traversal_scratch scratch;
+    std::vector<uint32_t> cycle;
 
-    for (size_t i = 0; i < _matrix[vertex].size (); ++i)
+    return find_cycle<false> (neighbour_view{this}, scratch, cycle);
+  }
+
+  // the keys of some cycle in walking order, empty if there's none
+  std::vector<std::string> cycle () const
+  {
+    traversal_scratch scratch;
+    std::vector<uint32_t> ids;
+    std::vector<std::string> keys;
+
+    find_cycle<false> (neighbour_view{this}, scratch, ids);
+
+    for (auto v : ids)
       {
-        if (visited.count (i) == 0 && _matrix[vertex][i] != 0)
-          {
-            dfs_helper (i, visited);
-          }
+        keys.push_back (_index_to_key[v]);
       }
+
+    return keys;
   }
 
-  void dfs () const
+  // distance and parent of every index from source, the triangle reads the same in both directions
+  bfs_result bfs_tree (std::string const &source, bfs_options const &options = {}) const
   {
-    std::set<size_t> visited;
+    neighbour_view view{this};
+    return direction_optimizing_bfs (view, view, static_cast<uint32_t> (index_of (source)), options);
+  }
+
+  size_t matrix_bytes () const { return _matrix.size () * sizeof (uint64_t); }
 
-    for (size_t i = 0; i < _matrix.size (); ++i)
+private:
+  static uint32_t constexpr _no_slot{~0u};
+
+  static size_t table_size (size_t n)
+  {
+    size_t size = 8;
+
+    while (size < n * 2)
       {
-        for (size_t j = 0; j < _matrix.size (); ++j)
-          {
-            if (visited.count (j) == 0)
-              {
-                dfs_helper (j, visited);
-              }
-          }
+        size *= 2;
       }
 
-    std::cout << '\n';
+    return size;
   }
 
-  void bfs () const
+  static bool test (std::vector<uint64_t> const &bits, size_t i) { return (bits[i / 64] >> (i % 64)) & 1; }
+  static void set (std::vector<uint64_t> &bits, size_t i) { bits[i / 64] |= uint64_t{1} << (i % 64); }
+
+  // slot holding key, or the empty slot where it would go
+  size_t find_slot (std::string const &key) const
   {
-    std::queue<size_t> current_vertices;
-    std::set<size_t> visited;
+    auto mask = _slots.size () - 1;
 
-    for (auto const &row : _matrix)
+    for (auto slot = std::hash<std::string>{}(key) & mask;; slot = (slot + 1) & mask)
       {
-        for (auto const &index : row)
+        if (_slots[slot] == _no_slot || _index_to_key[_slots[slot]] == key)
           {
-            if (visited.count (index) == 0)
-              {
-                visited.emplace (index);
-                current_vertices.emplace (index);
-
-                while (!current_vertices.empty ())
-                  {
-                    auto curr = current_vertices.front ();
-
-                    current_vertices.pop ();
-
-                    std::cout << _index_to_key.at (curr) << ' ';
-
-                    for (size_t i = 0; i < _matrix[curr].size (); ++i)
-                      {
-                        if (visited.count (i) == 0 && _matrix[curr][i] != 0)
-                          {
-                            visited.emplace (i);
-                            current_vertices.emplace (i);
-                          }
-                      }
-                  }
-              }
+            return slot;
           }
       }
-
-    std::cout << '\n';
   }
 
-  bool has_cycle_helper (size_t vertex, size_t parent, std::set<size_t> &visited) const
+  size_t index_of (std::string const &key) const
   {
-    visited.emplace (vertex);
+    auto slot = _slots[find_slot (key)];
 
-    for (size_t i = 0; i < _matrix.size (); ++i)
+    return slot == _no_slot ? _n : slot;
+  }
+
+  // bit of (i, j) in the packed triangle, rows start at i * n - i * (i - 1) / 2
+  size_t position (size_t i, size_t j) const
+  {
+    if (i > j)
       {
-        if (visited.count (i) == 0 && _matrix[vertex][i] != 0)
-          {
-            if (has_cycle_helper (i, vertex, visited))
-              {
-                return true;
-              }
-          }
-        else if (_matrix[vertex][i] != 0 && i != parent)
-          {
-            return true;
-          }
+        std::swap (i, j);
       }
 
-    return false;
+    return i * _n - i * (i - 1) / 2 + (j - i);
   }
 
-  bool has_cycle () const
+  bool edge (size_t i, size_t j) const
   {
-    std::set<size_t> visited;
+    auto bit = position (i, j);
+
+    return (_matrix[bit / 64] >> (bit % 64)) & 1;
+  }
 
-    for (size_t i = 0; i < _matrix.size (); ++i)
+  // 64 bits of the packed matrix starting at an arbitrary bit
+  uint64_t window (size_t bit) const
+  {
+    auto word = bit / 64;
+    auto shift = bit % 64;
+
+    return shift == 0 ? _matrix[word] : (_matrix[word] >> shift) | (_matrix[word + 1] << (64 - shift));
+  }
+
+  // smallest neighbour of vertex that is >= from, or _n. below the diagonal the neighbours are spread
+  // over the earlier rows one bit each, from the diagonal on they are contiguous in the vertex's own row
+  size_t next_neighbour (size_t vertex, size_t from) const
+  {
+    for (; from < vertex; ++from)
       {
-        for (size_t j = 0; j < _matrix.size (); ++j)
+        if (edge (from, vertex))
           {
-            if (visited.count (j) == 0)
-              {
-                if (has_cycle_helper (j, std::numeric_limits<size_t>::max (), visited))
-                  {
-                    return true;
-                  }
-              }
+            return from;
           }
       }
 
-    return false;
+    auto base = position (vertex, vertex) - vertex;
+
+    while (from < _n)
+      {
+        auto bits = window (base + from);
+
+        if (_n - from < 64)
+          {
+            bits &= (uint64_t{1} << (_n - from)) - 1;
+          }
+
+        if (bits != 0)
+          {
+            return from + __builtin_ctzll (bits);
+          }
+
+        from += 64;
+      }
+
+    return _n;
   }
 
-private:
-  std::map<std::string, size_t> _key_to_index;
-  std::map<size_t, std::string> _index_to_key;
-  std::vector<std::vector<size_t>> _matrix;
-  size_t _index;
+  struct neighbour_view
+  {
+    dense_undirected_graph const *_g;
+
+    uint32_t vertex_count () const { return static_cast<uint32_t> (_g->_n); }
+
+    uint64_t degree (uint32_t v) const
+    {
+      uint64_t count = 0;
+      for (auto i = _g->next_neighbour (v, 0); i < _g->_n; i = _g->next_neighbour (v, i + 1))
+        {
+          ++count;
+        }
+      return count;
+    }
+
+    template <typename Edge> void for_each_edge (uint32_t v, Edge &&edge) const
+    {
+      for (auto i = _g->next_neighbour (v, 0); i < _g->_n; i = _g->next_neighbour (v, i + 1))
+        {
+          if (edge (static_cast<uint32_t> (i)))
+            {
+              return;
+            }
+        }
+    }
+
+    bool has_vertex (uint32_t) const { return true; }
+
+    uint64_t first_edge (uint32_t) const { return 0; }
+
+    bool next_edge (uint32_t v, uint64_t &cursor, uint32_t &target) const
+    {
+      auto next = _g->next_neighbour (v, cursor);
+
+      if (next == _g->_n)
+        {
+          return false;
+        }
+
+      target = static_cast<uint32_t> (next);
+      cursor = next + 1;
+
+      return true;
+    }
+  };
+
+  size_t _n;
+  std::vector<std::string> _index_to_key;
+  std::vector<uint32_t> _slots; // open addressing, linear probing, indices into _index_to_key
+  std::vector<uint64_t> _matrix;
 };
 
+template <typename Graph>
+std::vector<std::string>
+dfs_order (Graph const &graph)
+{
+  std::vector<std::string> order;
+  graph.for_each_dfs (on_discover ([&] (uint32_t v) {
+    order.push_back (graph.name (v));
+    return false;
+  }));
+  return order;
+}
+
+template <typename Graph>
+std::vector<std::string>
+bfs_order (Graph const &graph)
+{
+  std::vector<std::string> order;
+  graph.for_each_bfs (on_discover ([&] (uint32_t v) {
+    order.push_back (graph.name (v));
+    return false;
+  }));
+  return order;
+}
+
 int
 main ()
 {
@@ -229,15 +359,14 @@ main ()
   assert (graph.has_edge ("1"s, "4"s));
   assert (graph.has_edge ("4"s, "1"s));
 
-  assert (!graph.has_cycle ());
-
-  std::cout << "...Printing graph...\n";
+  auto tree = graph.bfs_tree ("0"s);
+  assert ((tree._distance == std::vector<uint32_t>{0, 1, 1, 2, 2, 2, 2, 3}));
+  assert (tree._parent[7] == 3 && tree._parent[0] == 0);
 
-  std::cout << "...dfs...\n";
-  graph.dfs ();
+  assert (!graph.has_cycle ());
 
-  std::cout << "...bfs...\n";
-  graph.bfs ();
+  assert ((dfs_order (graph) == std::vector<std::string>{"0"s, "1"s, "3"s, "7"s, "4"s, "2"s, "5"s, "6"s}));
+  assert ((bfs_order (graph) == std::vector<std::string>{"0"s, "1"s, "2"s, "3"s, "4"s, "5"s, "6"s, "7"s}));
 
   graph.remove_edge ("A"s, "B"s);
 
@@ -265,11 +394,9 @@ main ()
   graph3.add_edge ("P"s, "P"s);
   assert (graph3.has_edge ("P"s, "P"s));
 
-  // this dfs shouldn't show a self-edge (but it's good if you ask)
-  std::cout << "...Printing dfs of graph that has a self edge...\n";
-  graph3.dfs ();
-  std::cout << "...Printing BFS...\n";
-  graph3.bfs ();
+  // a self edge doesn't show up in the traversal order
+  assert ((dfs_order (graph3) == std::vector<std::string>{"P"s, "Q"s, "R"s, "T"s}));
+  assert ((bfs_order (graph3) == std::vector<std::string>{"P"s, "Q"s, "R"s, "T"s}));
 
   // empty graph
   std::vector<std::string> vertices4;
@@ -289,11 +416,8 @@ main ()
   graph5.add_edge ("B"s, "D"s);
   assert (!graph5.has_cycle ());
 
-  std::cout << "...Graph 5 dfs...\n";
-  graph5.dfs ();
-
-  std::cout << "...Graph 5 bfs...\n";
-  graph5.bfs ();
+  assert ((dfs_order (graph5) == std::vector<std::string>{"A"s, "B"s, "D"s, "C"s}));
+  assert ((bfs_order (graph5) == std::vector<std::string>{"A"s, "B"s, "C"s, "D"s}));
 
   std::vector<std::string> vertices6{"A"s, "B"s, "C"s};
   dense_undirected_graph graph6 (vertices6);
@@ -303,6 +427,40 @@ main ()
   graph6.add_edge ("C"s, "A"s);
 
   assert (graph6.has_cycle ());
+  assert ((graph6.cycle () == std::vector<std::string>{"A"s, "B"s, "C"s}));
+  assert (graph5.cycle ().empty ());
+
+  {
+    // Packed triangle against a plain full matrix, with sizes that don't line up with words
+    for (size_t n : {1, 63, 64, 65, 130, 700})
+      {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < n; ++i)
+          {
+            keys.emplace_back ("k" + std::to_string (i));
+          }
+        dense_undirected_graph g (keys);
+        std::vector<std::vector<bool>> full (n, std::vector<bool> (n, false));
+        std::mt19937 rng (static_cast<uint32_t> (n));
+        for (size_t e = 0; e < 3 * n; ++e)
+          {
+            auto a = rng () % n;
+            auto b = rng () % n;
+            bool add = rng () % 4 != 0;
+            assert (add ? g.add_edge (keys[a], keys[b]) : g.remove_edge (keys[a], keys[b]));
+            full[a][b] = full[b][a] = add;
+          }
+        for (size_t a = 0; a < n; ++a)
+          {
+            for (size_t b = 0; b < n; ++b)
+              {
+                assert (g.has_edge (keys[a], keys[b]) == full[a][b]);
+              }
+          }
+        assert (!g.has_edge (keys[0], "missing"s));
+        assert (g.matrix_bytes () <= (n * (n + 1) / 2 + 63) / 64 * 8 + 8);
+      }
+  }
 
   std::cout << "All tests passed!\n";
 
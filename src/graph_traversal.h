@@ -0,0 +1,784 @@
+#ifndef GRAPH_TRAVERSAL_H
+#define GRAPH_TRAVERSAL_H
+
+//
+// traversal engines shared by the graph programs. they don't know about names or how a graph is stored,
+// they get a view that hands out dense uint32_t vertex ids and calls back once per edge:
+//
+//   uint32_t vertex_count () const
+//   uint64_t degree (uint32_t v) const
+//   template <typename Edge> void for_each_edge (uint32_t v, Edge &&edge) const  // stops once edge () is true
+//
+// depth first search can't live with a callback, a frame has to stop halfway through a vertex's edges and
+// pick up again later, so for that the view also hands out a resumable cursor:
+//
+//   bool has_vertex (uint32_t v) const                                   // false for removed ids
+//   uint64_t first_edge (uint32_t v) const
+//   bool next_edge (uint32_t v, uint64_t &cursor, uint32_t &target) const  // false once v has no more edges
+//
+// csr_view and adjacency_list_view below cover the sparse graphs, the dense ones bring their own
+//
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+uint32_t constexpr unreached{~0u};
+
+// out edges of v are _targets[_offsets[v] .. _offsets[v + 1])
+struct csr_view
+{
+  uint32_t _vertices;
+  uint64_t const *_offsets;
+  uint32_t const *_targets;
+
+  uint32_t vertex_count () const { return _vertices; }
+
+  uint64_t degree (uint32_t v) const { return _offsets[v + 1] - _offsets[v]; }
+
+  template <typename Edge> void for_each_edge (uint32_t v, Edge &&edge) const
+  {
+    for (auto e = _offsets[v]; e < _offsets[v + 1]; ++e)
+      {
+        if (edge (_targets[e]))
+          {
+            return;
+          }
+      }
+  }
+
+  bool has_vertex (uint32_t) const { return true; }
+
+  uint64_t first_edge (uint32_t v) const { return _offsets[v]; }
+
+  bool next_edge (uint32_t v, uint64_t &cursor, uint32_t &target) const
+  {
+    if (cursor == _offsets[v + 1])
+      {
+        return false;
+      }
+    target = _targets[cursor++];
+    return true;
+  }
+};
+
+// one vector of neighbour ids per vertex, _alive (if there is one) says which ids are still in use
+struct adjacency_list_view
+{
+  std::vector<std::vector<uint32_t>> const *_lists;
+  std::vector<bool> const *_alive{nullptr};
+
+  uint32_t vertex_count () const { return static_cast<uint32_t> (_lists->size ()); }
+
+  uint64_t degree (uint32_t v) const { return (*_lists)[v].size (); }
+
+  template <typename Edge> void for_each_edge (uint32_t v, Edge &&edge) const
+  {
+    for (auto w : (*_lists)[v])
+      {
+        if (edge (w))
+          {
+            return;
+          }
+      }
+  }
+
+  bool has_vertex (uint32_t v) const { return _alive == nullptr || (*_alive)[v]; }
+
+  uint64_t first_edge (uint32_t) const { return 0; }
+
+  bool next_edge (uint32_t v, uint64_t &cursor, uint32_t &target) const
+  {
+    auto const &list = (*_lists)[v];
+    if (cursor == list.size ())
+      {
+        return false;
+      }
+    target = list[cursor++];
+    return true;
+  }
+};
+
+struct bfs_result
+{
+  std::vector<uint32_t> _distance; // hops from the source, unreached when there's no path
+  std::vector<uint32_t> _parent;   // who discovered the vertex, the source is its own parent
+};
+
+struct bfs_options
+{
+  unsigned _threads{std::max (1u, std::thread::hardware_concurrency ())};
+  bool _direction_optimizing{true};
+  uint64_t _alpha{14}; // go bottom-up once the frontier's edges outnumber 1/alpha of the unexplored ones
+  uint64_t _beta{24};  // and back top-down when the frontier drops under 1/beta of the vertices
+};
+
+// a fixed set of threads that runs jobs one after another, each job handing [begin, end) chunks of [0, count)
+// to whoever asks next. the threads are started once and parked on a condition variable between jobs, so bfs
+// can run a job per level without starting a pool per level, which would cost more than the work on long
+// thin graphs with thousands of levels. the calling thread pitches in as worker 0, and a job that fits in
+// one chunk runs on it alone without waking anybody
+class chunk_pool
+{
+public:
+  explicit chunk_pool (unsigned threads) : _threads{std::max (1u, threads)}
+  {
+    for (unsigned t = 1; t < _threads; ++t)
+      {
+        _pool.emplace_back ([this, t] { work (t); });
+      }
+  }
+
+  ~chunk_pool ()
+  {
+    {
+      std::lock_guard lock (_mutex);
+      _stop = true;
+    }
+    _wake.notify_all ();
+    for (auto &t : _pool)
+      {
+        t.join ();
+      }
+  }
+
+  chunk_pool (chunk_pool const &) = delete;
+  chunk_pool &operator= (chunk_pool const &) = delete;
+
+  // body (worker, begin, end) for every chunk, returns once all of them are done
+  template <typename Body>
+  void run (size_t count, size_t chunk, Body &&body)
+  {
+    _count = count;
+    _chunk = chunk;
+    _next.store (0, std::memory_order_relaxed);
+    _body = &body;
+    _call = [] (void const *b, unsigned worker, size_t begin, size_t end) {
+      (*static_cast<std::remove_reference_t<Body> const *> (b)) (worker, begin, end);
+    };
+
+    if (_pool.empty () || count <= chunk)
+      {
+        drain (0);
+        return;
+      }
+
+    {
+      std::lock_guard lock (_mutex);
+      _busy = _pool.size ();
+      ++_job;
+    }
+    _wake.notify_all ();
+    drain (0);
+    std::unique_lock lock (_mutex);
+    _done.wait (lock, [this] { return _busy == 0; });
+  }
+
+private:
+  void drain (unsigned worker)
+  {
+    for (auto begin = _next.fetch_add (_chunk, std::memory_order_relaxed); begin < _count;
+         begin = _next.fetch_add (_chunk, std::memory_order_relaxed))
+      {
+        _call (_body, worker, begin, std::min (_count, begin + _chunk));
+      }
+  }
+
+  void work (unsigned worker)
+  {
+    uint64_t seen = 0;
+    for (;;)
+      {
+        {
+          std::unique_lock lock (_mutex);
+          _wake.wait (lock, [&] { return _stop || _job != seen; });
+          if (_stop)
+            {
+              return;
+            }
+          seen = _job;
+        }
+        drain (worker);
+        std::lock_guard lock (_mutex);
+        if (--_busy == 0)
+          {
+            _done.notify_one ();
+          }
+      }
+  }
+
+  unsigned _threads;
+  std::vector<std::thread> _pool;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _done;
+  uint64_t _job{0};  // bumped once per job that needs the workers
+  size_t _busy{0};   // workers still draining the current job
+  bool _stop{false};
+  // the current job, written before _job is bumped under _mutex so the workers see it
+  size_t _count{0};
+  size_t _chunk{1};
+  std::atomic<size_t> _next{0};
+  void const *_body{nullptr};
+  void (*_call) (void const *, unsigned, size_t, size_t){nullptr};
+};
+
+//
+// Beamer's direction-optimizing bfs. a top-down step walks the out edges of the frontier and claims
+// unvisited targets with an atomic fetch_or on the visited bitset. once the frontier gets heavy, a
+// bottom-up step instead has every unvisited vertex walk its in edges until it finds a parent in the
+// frontier, which skips most of the edges on the big middle levels of low-diameter graphs. in is the
+// transpose of out, for undirected graphs just pass the same view twice. parents can differ from run to
+// run when threads race for a vertex, distances can't
+//
+template <typename Out, typename In>
+bfs_result
+direction_optimizing_bfs (Out const &out, In const &in, uint32_t source, bfs_options const &options = {})
+{
+  static size_t constexpr top_down_chunk{256};
+  static size_t constexpr bottom_up_chunk{4096}; // multiple of 64 so a word of the bitsets has one owner
+
+  struct alignas (64) tally
+  {
+    uint64_t _vertices;
+    uint64_t _edges;
+  };
+
+  auto n = out.vertex_count ();
+  auto threads = std::max (1u, options._threads);
+  bfs_result result{std::vector<uint32_t> (n, unreached), std::vector<uint32_t> (n, unreached)};
+
+  if (source >= n)
+    {
+      return result;
+    }
+
+  size_t words = (size_t{n} + 63) / 64;
+  std::vector<std::atomic<uint64_t>> visited (words);
+  for (auto &word : visited)
+    {
+      word.store (0, std::memory_order_relaxed);
+    }
+  std::vector<uint64_t> frontier_bits (words, 0);
+  std::vector<uint64_t> next_bits (words, 0);
+  std::vector<uint32_t> frontier{source};
+  std::vector<std::vector<uint32_t>> found (threads);
+  std::vector<tally> tallies (threads);
+  chunk_pool pool (threads);
+
+  uint64_t unexplored_edges = 0;
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      unexplored_edges += out.degree (v);
+    }
+
+  visited[source / 64].store (uint64_t{1} << (source % 64), std::memory_order_relaxed);
+  result._distance[source] = 0;
+  result._parent[source] = source;
+  uint64_t frontier_vertices = 1;
+  uint64_t frontier_edges = out.degree (source);
+  unexplored_edges -= frontier_edges;
+  bool bottom_up = false;
+
+  for (uint32_t level = 1; frontier_vertices > 0; ++level)
+    {
+      if (!bottom_up && options._direction_optimizing && frontier_edges > unexplored_edges / options._alpha)
+        {
+          bottom_up = true;
+          std::fill (frontier_bits.begin (), frontier_bits.end (), 0);
+          for (auto v : frontier)
+            {
+              frontier_bits[v / 64] |= uint64_t{1} << (v % 64);
+            }
+        }
+      else if (bottom_up && frontier_vertices < n / options._beta)
+        {
+          bottom_up = false;
+          frontier.clear ();
+          for (size_t w = 0; w < words; ++w)
+            {
+              for (auto bits = frontier_bits[w]; bits != 0; bits &= bits - 1)
+                {
+                  frontier.push_back (static_cast<uint32_t> (w * 64 + __builtin_ctzll (bits)));
+                }
+            }
+        }
+
+      std::fill (tallies.begin (), tallies.end (), tally{0, 0});
+
+      if (bottom_up)
+        {
+          std::fill (next_bits.begin (), next_bits.end (), 0);
+          pool.run (n, bottom_up_chunk, [&] (unsigned worker, size_t begin, size_t end) {
+            for (auto v = static_cast<uint32_t> (begin); v < end; ++v)
+              {
+                auto bit = uint64_t{1} << (v % 64);
+                if (visited[v / 64].load (std::memory_order_relaxed) & bit)
+                  {
+                    continue;
+                  }
+                in.for_each_edge (v, [&] (uint32_t u) {
+                  if ((frontier_bits[u / 64] >> (u % 64) & 1) == 0)
+                    {
+                      return false;
+                    }
+                  result._distance[v] = level;
+                  result._parent[v] = u;
+                  next_bits[v / 64] |= bit;
+                  return true;
+                });
+              }
+            for (auto w = begin / 64; w < (end + 63) / 64; ++w)
+              {
+                visited[w].fetch_or (next_bits[w], std::memory_order_relaxed);
+                for (auto bits = next_bits[w]; bits != 0; bits &= bits - 1)
+                  {
+                    ++tallies[worker]._vertices;
+                    tallies[worker]._edges += out.degree (static_cast<uint32_t> (w * 64 + __builtin_ctzll (bits)));
+                  }
+              }
+          });
+          std::swap (frontier_bits, next_bits);
+        }
+      else
+        {
+          pool.run (frontier.size (), top_down_chunk, [&] (unsigned worker, size_t begin, size_t end) {
+            for (auto i = begin; i < end; ++i)
+              {
+                auto v = frontier[i];
+                out.for_each_edge (v, [&] (uint32_t w) {
+                  auto bit = uint64_t{1} << (w % 64);
+                  if ((visited[w / 64].load (std::memory_order_relaxed) & bit)
+                      || (visited[w / 64].fetch_or (bit, std::memory_order_relaxed) & bit))
+                    {
+                      return false;
+                    }
+                  result._distance[w] = level;
+                  result._parent[w] = v;
+                  found[worker].push_back (w);
+                  ++tallies[worker]._vertices;
+                  tallies[worker]._edges += out.degree (w);
+                  return false;
+                });
+              }
+          });
+          frontier.clear ();
+          for (auto &local : found)
+            {
+              frontier.insert (frontier.end (), local.begin (), local.end ());
+              local.clear ();
+            }
+        }
+
+      frontier_vertices = 0;
+      frontier_edges = 0;
+      for (auto const &t : tallies)
+        {
+          frontier_vertices += t._vertices;
+          frontier_edges += t._edges;
+        }
+      unexplored_edges -= frontier_edges;
+    }
+
+  return result;
+}
+
+//
+// depth first search with an explicit stack and one colour byte per vertex: white is unseen, grey is on
+// the current path, black is done. the stack never holds more than the longest path, so a 10M vertex
+// chain costs 10MB of colours plus 160MB of frames at worst instead of a blown call stack. keep the
+// scratch around between calls and nothing gets allocated once it has grown to the graph
+//
+enum dfs_color : uint8_t
+{
+  dfs_white,
+  dfs_grey,
+  dfs_black
+};
+
+struct dfs_frame
+{
+  uint32_t _vertex;
+  uint32_t _parent; // unreached for roots
+  uint64_t _cursor;
+};
+
+struct traversal_scratch
+{
+  std::vector<uint8_t> _color;
+  std::vector<dfs_frame> _stack;
+  std::vector<uint32_t> _queue;
+
+  void reset (uint32_t n)
+  {
+    _color.assign (n, dfs_white);
+    _stack.clear ();
+    _queue.clear ();
+  }
+};
+
+//
+// hooks for for_each_dfs and for_each_bfs. derive from this and hide the ones you care about, the calls
+// are resolved at compile time so the rest cost nothing. returning true from any hook stops the traversal
+// right there. edge sees every edge the traversal looks at, tree edge or not
+//
+struct graph_visitor
+{
+  bool discover (uint32_t) { return false; }
+  bool edge (uint32_t, uint32_t) { return false; }
+  bool finish (uint32_t) { return false; }
+};
+
+template <typename Discover> struct discover_visitor : graph_visitor
+{
+  Discover _discover;
+
+  bool discover (uint32_t v) { return _discover (v); }
+};
+
+// for when all you want is the vertices in order: for_each_dfs (view, scratch, on_discover ([] (uint32_t v) {..}))
+template <typename Discover>
+discover_visitor<std::decay_t<Discover>>
+on_discover (Discover &&discover)
+{
+  return {{}, std::forward<Discover> (discover)};
+}
+
+//
+// depth first from root, or from every still white id in increasing order when root is unreached.
+// discover fires when a vertex turns grey, finish when its last edge is done. returns true if a hook
+// stopped it early
+//
+template <typename View, typename Visitor>
+bool
+for_each_dfs (View const &view, traversal_scratch &scratch, Visitor &&visitor, uint32_t root = unreached)
+{
+  auto n = view.vertex_count ();
+  scratch.reset (n);
+  auto &color = scratch._color;
+  auto &stack = scratch._stack;
+  auto first = root == unreached ? 0 : root;
+  auto last = root == unreached ? n : std::min (n, root + 1);
+
+  for (auto start = first; start < last; ++start)
+    {
+      if (color[start] != dfs_white || !view.has_vertex (start))
+        {
+          continue;
+        }
+      color[start] = dfs_grey;
+      if (visitor.discover (start))
+        {
+          return true;
+        }
+      stack.push_back ({start, unreached, view.first_edge (start)});
+      while (!stack.empty ())
+        {
+          auto &top = stack.back ();
+          uint32_t next;
+          if (!view.next_edge (top._vertex, top._cursor, next))
+            {
+              color[top._vertex] = dfs_black;
+              auto done = top._vertex;
+              stack.pop_back ();
+              if (visitor.finish (done))
+                {
+                  return true;
+                }
+              continue;
+            }
+          if (visitor.edge (top._vertex, next))
+            {
+              return true;
+            }
+          if (color[next] == dfs_white)
+            {
+              color[next] = dfs_grey;
+              stack.push_back ({next, top._vertex, view.first_edge (next)});
+              if (visitor.discover (next))
+                {
+                  return true;
+                }
+            }
+        }
+    }
+  return false;
+}
+
+// breadth first, same rules for root and early exit. discover fires when a vertex is queued, which is also
+// the order they come out in, finish once all of its edges have been looked at
+template <typename View, typename Visitor>
+bool
+for_each_bfs (View const &view, traversal_scratch &scratch, Visitor &&visitor, uint32_t root = unreached)
+{
+  auto n = view.vertex_count ();
+  scratch.reset (n);
+  auto &color = scratch._color;
+  auto &queue = scratch._queue;
+  auto first = root == unreached ? 0 : root;
+  auto last = root == unreached ? n : std::min (n, root + 1);
+
+  for (auto start = first; start < last; ++start)
+    {
+      if (color[start] != dfs_white || !view.has_vertex (start))
+        {
+          continue;
+        }
+      color[start] = dfs_grey;
+      if (visitor.discover (start))
+        {
+          return true;
+        }
+      queue.assign (1, start);
+      for (size_t head = 0; head < queue.size (); ++head)
+        {
+          auto curr = queue[head];
+          auto cursor = view.first_edge (curr);
+          uint32_t next;
+          while (view.next_edge (curr, cursor, next))
+            {
+              if (visitor.edge (curr, next))
+                {
+                  return true;
+                }
+              if (color[next] == dfs_white)
+                {
+                  color[next] = dfs_grey;
+                  queue.push_back (next);
+                  if (visitor.discover (next))
+                    {
+                      return true;
+                    }
+                }
+            }
+          color[curr] = dfs_black;
+          if (visitor.finish (curr))
+            {
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+// an edge into a grey vertex closes a cycle, and the grey vertices are exactly the ones on the stack, so
+// the cycle is the stack from that vertex up. undirected graphs ignore the edge back to the parent
+template <bool directed, typename View>
+bool
+find_cycle (View const &view, traversal_scratch &scratch, std::vector<uint32_t> &cycle)
+{
+  auto n = view.vertex_count ();
+  scratch.reset (n);
+  cycle.clear ();
+  auto &color = scratch._color;
+  auto &stack = scratch._stack;
+
+  for (uint32_t root = 0; root < n; ++root)
+    {
+      if (color[root] != dfs_white || !view.has_vertex (root))
+        {
+          continue;
+        }
+      color[root] = dfs_grey;
+      stack.push_back ({root, unreached, view.first_edge (root)});
+      while (!stack.empty ())
+        {
+          auto &top = stack.back ();
+          uint32_t next;
+          if (!view.next_edge (top._vertex, top._cursor, next))
+            {
+              color[top._vertex] = dfs_black;
+              stack.pop_back ();
+              continue;
+            }
+          if (color[next] == dfs_white)
+            {
+              color[next] = dfs_grey;
+              stack.push_back ({next, top._vertex, view.first_edge (next)});
+            }
+          else if (color[next] == dfs_grey && (directed || next != top._parent))
+            {
+              auto first = stack.size ();
+              while (stack[--first]._vertex != next)
+                {
+                }
+              for (auto i = first; i < stack.size (); ++i)
+                {
+                  cycle.push_back (stack[i]._vertex);
+                }
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+//
+// Kahn's algorithm: vertices nothing points at go first, and taking them out frees up the next ones. the
+// order doubles as the cycle check, when it comes up short everything left over sits on or behind a cycle
+// and order holds the part that could be sorted
+//
+template <typename View>
+bool
+topological_order (View const &view, std::vector<uint32_t> &order)
+{
+  auto n = view.vertex_count ();
+  std::vector<uint32_t> in_degree (n, 0);
+  uint32_t live = 0;
+  order.clear ();
+
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      if (view.has_vertex (v))
+        {
+          ++live;
+          view.for_each_edge (v, [&in_degree] (uint32_t w) { return ++in_degree[w], false; });
+        }
+    }
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      if (view.has_vertex (v) && in_degree[v] == 0)
+        {
+          order.push_back (v);
+        }
+    }
+  for (size_t head = 0; head < order.size (); ++head)
+    {
+      view.for_each_edge (order[head], [&] (uint32_t w) {
+        if (--in_degree[w] == 0)
+          {
+            order.push_back (w);
+          }
+        return false;
+      });
+    }
+  return order.size () == live;
+}
+
+// strongly connected components collapsed to single vertices. component ids come out in topological order,
+// so every edge of the dag goes from a lower id to a higher one
+struct condensation
+{
+  uint32_t _components{0};
+  std::vector<uint32_t> _component; // per vertex, unreached for ids the view doesn't have
+  std::vector<uint64_t> _offsets;   // the dag itself, csr over component ids without duplicate edges
+  std::vector<uint32_t> _targets;
+
+  csr_view view () const { return csr_view{_components, _offsets.data (), _targets.data ()}; }
+};
+
+//
+// Tarjan's algorithm with the recursion unrolled into dfs frames. a vertex is on the component stack for as
+// long as it has an index but no component yet, so that needs no separate flag. a vertex whose lowlink
+// never dropped below its own index is the root of a component, which is everything above it on that
+// stack. components finish sinks first, so they get numbered backwards
+//
+template <typename View>
+condensation
+condense (View const &view)
+{
+  auto n = view.vertex_count ();
+  condensation result;
+  auto &component = result._component;
+  std::vector<uint32_t> index (n, unreached);
+  std::vector<uint32_t> low (n, 0);
+  std::vector<uint32_t> members;
+  std::vector<dfs_frame> stack;
+  uint32_t next_index = 0;
+  uint32_t finished = 0;
+
+  component.assign (n, unreached);
+  auto enter = [&] (uint32_t v, uint32_t parent) {
+    index[v] = low[v] = next_index++;
+    members.push_back (v);
+    stack.push_back ({v, parent, view.first_edge (v)});
+  };
+
+  for (uint32_t root = 0; root < n; ++root)
+    {
+      if (index[root] != unreached || !view.has_vertex (root))
+        {
+          continue;
+        }
+      enter (root, unreached);
+      while (!stack.empty ())
+        {
+          auto &top = stack.back ();
+          auto v = top._vertex;
+          uint32_t next;
+          if (view.next_edge (v, top._cursor, next))
+            {
+              if (index[next] == unreached)
+                {
+                  enter (next, v);
+                }
+              else if (component[next] == unreached)
+                {
+                  low[v] = std::min (low[v], index[next]);
+                }
+              continue;
+            }
+          auto parent = top._parent;
+          stack.pop_back ();
+          if (low[v] == index[v])
+            {
+              uint32_t w;
+              do
+                {
+                  w = members.back ();
+                  members.pop_back ();
+                  component[w] = finished;
+                }
+              while (w != v);
+              ++finished;
+            }
+          if (parent != unreached)
+            {
+              low[parent] = std::min (low[parent], low[v]);
+            }
+        }
+    }
+
+  result._components = finished;
+  for (auto &c : component)
+    {
+      c = c == unreached ? unreached : finished - 1 - c;
+    }
+  std::vector<std::pair<uint32_t, uint32_t>> edges;
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      if (component[v] == unreached)
+        {
+          continue;
+        }
+      view.for_each_edge (v, [&] (uint32_t w) {
+        if (component[w] != component[v])
+          {
+            edges.emplace_back (component[v], component[w]);
+          }
+        return false;
+      });
+    }
+  std::sort (edges.begin (), edges.end ());
+  edges.erase (std::unique (edges.begin (), edges.end ()), edges.end ());
+  result._offsets.assign (size_t{finished} + 1, 0);
+  result._targets.reserve (edges.size ());
+  for (auto [from, to] : edges)
+    {
+      ++result._offsets[from + 1];
+      result._targets.push_back (to);
+    }
+  for (uint32_t c = 0; c < finished; ++c)
+    {
+      result._offsets[c + 1] += result._offsets[c];
+    }
+  return result;
+}
+
+#endif
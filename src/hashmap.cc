@@ -1,71 +1,896 @@
 #include <iostream>
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <string>
-#include <list>
-#include <array>
+#include <string_view>
+#include <vector>
 #include <optional>
 #include <cassert>
 #include <utility>
+#include <memory>
+#include <functional>
 #include <algorithm>
+#include <type_traits>
+#include <shared_mutex>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <immintrin.h>
 
-size_t constexpr _capacity{32};
+// swiss table style open addressing: one control byte per slot, probed a group of 16 at a time with sse2.
+// empty and deleted have the top bit set, full slots store the low 7 bits of the hash, so a single
+// compare + movemask filters a whole group before we ever touch a key
+size_t constexpr _initial_capacity{32};
+int8_t constexpr _empty{static_cast<int8_t> (0x80)};
+int8_t constexpr _deleted{static_cast<int8_t> (0xfe)};
+size_t constexpr _group_width{16};
 
+static inline int8_t
+h2 (size_t hash)
+{
+  return static_cast<int8_t> (hash & 0x7f);
+}
+
+static inline uint32_t
+match (int8_t const *group, int8_t byte)
+{
+  auto ctrl = _mm_loadu_si128 (reinterpret_cast<__m128i const *> (group));
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (ctrl, _mm_set1_epi8 (byte)));
+}
+
+// empty and deleted are the only bytes with the top bit set, movemask picks exactly that
+static inline uint32_t
+match_empty_or_deleted (int8_t const *group)
+{
+  return _mm_movemask_epi8 (_mm_loadu_si128 (reinterpret_cast<__m128i const *> (group)));
+}
+
+// triangular probing over groups, visits every group once bc the group count is a power of 2
+static inline size_t
+find_insert_slot (int8_t const *ctrl, size_t group_mask, size_t hash)
+{
+  auto group = (hash >> 7) & group_mask;
+  for (size_t step = 1;; ++step)
+    {
+      auto bits = match_empty_or_deleted (&ctrl[group * _group_width]);
+      if (bits != 0)
+        return group * _group_width + __builtin_ctz (bits);
+      group = (group + step) & group_mask;
+    }
+}
+
+// smallest table that holds n entries under 7/8 load
+static inline size_t
+capacity_for (size_t n)
+{
+  size_t capacity = _initial_capacity;
+  while (capacity - capacity / 8 < n)
+    capacity *= 2;
+  return capacity;
+}
+
+// wyhash style: 64x64->128 multiply and fold the halves, cheap and mixes every input bit into the low ones
+static inline uint64_t
+mum (uint64_t a, uint64_t b)
+{
+  auto r = static_cast<unsigned __int128> (a) * b;
+  return static_cast<uint64_t> (r) ^ static_cast<uint64_t> (r >> 64);
+}
+
+static inline uint64_t
+hash_bytes (void const *data, size_t n)
+{
+  static uint64_t constexpr k0{0xa0761d6478bd642full};
+  static uint64_t constexpr k1{0xe7037ed1a0b428dbull};
+  auto const *p = static_cast<unsigned char const *> (data);
+  uint64_t h = k0 ^ n;
+  uint64_t word;
+  for (; n >= 8; n -= 8, p += 8)
+    {
+      std::memcpy (&word, p, 8);
+      h = mum (h ^ word, k1);
+    }
+  if (n > 0)
+    {
+      word = 0;
+      std::memcpy (&word, p, n);
+      h = mum (h ^ word, k1);
+    }
+  return mum (h, k0);
+}
+
+// c++ port of the arena in linear_alloc.c: bump through a caller owned buffer, free it all in one go.
+// minus the memset, whoever asked for the memory constructs into it anyway
+struct arena
+{
+  unsigned char *buf;
+  size_t buf_len;
+  size_t prev_offset;
+  size_t curr_offset;
+};
+
+static void
+arena_init (arena *a, unsigned char *buf, size_t buf_len)
+{
+  a->buf = buf;
+  a->buf_len = buf_len;
+  a->curr_offset = a->prev_offset = 0;
+}
+
+static void *
+arena_alloc_align (arena *a, size_t size, size_t align)
+{
+  assert ((align & (align - 1)) == 0 && "this ain't a power of 2");
+  auto curr_ptr = reinterpret_cast<uintptr_t> (a->buf) + a->curr_offset;
+  auto offset = ((curr_ptr + align - 1) & ~(align - 1)) - reinterpret_cast<uintptr_t> (a->buf);
+  if (offset + size > a->buf_len)
+    return nullptr;
+  a->prev_offset = offset;
+  a->curr_offset = offset + size;
+  return &a->buf[offset];
+}
+
+static void
+arena_free (arena *a)
+{
+  a->curr_offset = a->prev_offset = 0;
+}
+
+// std allocator on top of an arena: deallocate does nothing, the memory comes back with arena_free. so
+// tearing down a scratch map is destroying it (no free calls) and one arena_free
+template <typename T>
+struct arena_allocator
+{
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  arena *_arena;
+
+  // only there so empty slots can be default constructed, an empty string never allocates
+  arena_allocator () : _arena{nullptr} {}
+
+  explicit arena_allocator (arena *a) : _arena{a} {}
+
+  template <typename U>
+  arena_allocator (arena_allocator<U> const &other) : _arena{other._arena}
+  {}
+
+  T *allocate (size_t n)
+  {
+    assert (_arena != nullptr);
+    auto *p = arena_alloc_align (_arena, n * sizeof (T), alignof (T));
+    if (p == nullptr)
+      throw std::bad_alloc ();
+    return static_cast<T *> (p);
+  }
+
+  void deallocate (T *, size_t) {}
+
+  template <typename U>
+  bool operator== (arena_allocator<U> const &other) const
+  {
+    return _arena == other._arena;
+  }
+
+  template <typename U>
+  bool operator!= (arena_allocator<U> const &other) const
+  {
+    return _arena != other._arena;
+  }
+};
+
+using arena_string = std::basic_string<char, std::char_traits<char>, arena_allocator<char>>;
+
+// any allocator: std::string and arena_string are both looked up and assigned through string_view
+template <typename T>
+struct is_char_string : std::false_type
+{};
+
+template <typename Traits, typename A>
+struct is_char_string<std::basic_string<char, Traits, A>> : std::true_type
+{};
+
+template <typename T>
+using key_view_t = std::conditional_t<is_char_string<T>::value, std::string_view, T const &>;
+
+// default hash: strings go through string_view so lookups never need a std::string, integers get a single
+// mum, anything else has to be plain bytes (no padding) or bring its own hash
+template <typename K, typename = void>
+struct fast_hash
+{
+  static_assert (std::has_unique_object_representations_v<K>, "key has padding bytes, pass a hash functor");
+
+  size_t operator() (K const &key) const
+  {
+    if constexpr (std::is_integral_v<K>)
+      return mum (static_cast<uint64_t> (key), 0x9e3779b97f4a7c15ull);
+    else
+      return hash_bytes (&key, sizeof (K));
+  }
+};
+
+template <typename K>
+struct fast_hash<K, std::enable_if_t<is_char_string<K>::value>>
+{
+  size_t operator() (std::string_view key) const { return hash_bytes (key.data (), key.size ()); }
+};
+
+// on-disk image written by hashmap::save and served by hashmap_image. everything is addressed by offsets
+// from the start of the file, so it works wherever the mapping lands:
+//   header | control bytes | slots (64-byte aligned) | key and value bytes
+// the control bytes follow the in-memory layout exactly, so lookups on the image probe the same way. that
+// only works with the hash the map was saved with, so the header keeps what it makes of a fixed probe key
+struct image_header
+{
+  char _magic[8];
+  uint64_t _capacity;
+  uint64_t _size;
+  uint64_t _ctrl_offset;
+  uint64_t _slots_offset;
+  uint64_t _strings_offset;
+  uint64_t _file_size;
+  uint64_t _hash_check;
+};
+
+static_assert (sizeof (image_header) <= 64, "the control bytes start at offset 64");
+
+// value bytes sit right after the key bytes
+struct image_slot
+{
+  uint64_t _hash;
+  uint64_t _offset;
+  uint32_t _key_len;
+  uint32_t _value_len;
+};
+
+static char constexpr _image_magic[8]{'h', 'm', 'i', 'm', 'g', '0', '0', '2'};
+static std::string_view constexpr _image_probe_key{"hashmap_image probe key"};
+
+template <typename K = std::string, typename V = std::string, typename Hash = fast_hash<K>,
+          typename Eq = std::equal_to<>, typename Alloc = std::allocator<std::pair<K, V>>>
 class hashmap
 {
-  std::array<std::list<std::pair<std::string, std::string>>, _capacity> _buckets;
+  // string keys/values are taken as string_view so callers holding raw buffers never allocate to probe
+  using key_view = key_view_t<K>;
+  using value_view = key_view_t<V>;
+
+  // lookups handed over in bulk in get_batch, by value since an array of references isn't a thing
+  using batch_key = std::conditional_t<is_char_string<K>::value, std::string_view, K>;
+
+  // how many keys apart get_batch's pipeline stages run: enough to cover a dram miss, few enough that the
+  // prefetched lines are still in l1 when we come back to them
+  static size_t constexpr _batch_width{16};
+
+  // cheap keys are compared directly; expensive ones keep the full hash next to them so mismatches are
+  // rejected without touching the key bytes and migrating during a resize never has to rehash
+  static bool constexpr _store_hash{!std::is_trivially_copyable_v<K>};
+
+  struct hashed_entry
+  {
+    size_t _hash;
+    K _key;
+    V _value;
+  };
+
+  struct plain_entry
+  {
+    K _key;
+    V _value;
+  };
+
+  using entry = std::conditional_t<_store_hash, hashed_entry, plain_entry>;
+  using ctrl_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<int8_t>;
+  using entry_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<entry>;
+
+  static size_t constexpr _npos{static_cast<size_t> (-1)};
+  // groups moved from the old table to the new one on every put/remove while a resize is in flight.
+  // the new table is at least as big as the old one and the old one has capacity / 16 groups, so
+  // migration is always done long before the new table could fill up
+  static size_t constexpr _migrate_groups_per_op{2};
+
+  struct table
+  {
+    std::vector<int8_t, ctrl_alloc> _ctrl;
+    std::vector<entry, entry_alloc> _slots;
+    size_t _growth_left{0}; // slots we can still fill (full or deleted) before we go over 7/8 load
+
+    explicit table (Alloc const &alloc) : _ctrl (alloc), _slots (alloc) {}
+
+    table (size_t capacity, Alloc const &alloc)
+      : _ctrl (capacity, _empty, alloc), _slots (capacity, alloc), _growth_left{capacity - capacity / 8}
+    {}
+
+    size_t capacity () const { return _ctrl.size (); }
+
+    size_t groups () const { return capacity () / _group_width; }
+
+    size_t find (key_view key, size_t hash, Eq const &eq) const
+    {
+      if (_ctrl.empty ())
+        return _npos;
+      auto mask = groups () - 1;
+      auto group = (hash >> 7) & mask;
+      for (size_t step = 1;; ++step)
+        {
+          auto const *ctrl = &_ctrl[group * _group_width];
+          for (auto bits = match (ctrl, h2 (hash)); bits != 0; bits &= bits - 1)
+            {
+              auto slot = group * _group_width + __builtin_ctz (bits);
+              if constexpr (_store_hash)
+                {
+                  if (_slots[slot]._hash != hash)
+                    continue;
+                }
+              if (eq (_slots[slot]._key, key))
+                return slot;
+            }
+          // an empty slot means the key was never pushed past this group
+          if (match (ctrl, _empty) != 0)
+            return _npos;
+          group = (group + step) & mask;
+        }
+    }
+
+    // caller guarantees the key isn't in here already
+    void insert (size_t hash, entry &&e)
+    {
+      auto slot = find_insert_slot (_ctrl.data (), groups () - 1, hash);
+      if (_ctrl[slot] == _empty)
+        {
+          assert (_growth_left > 0);
+          --_growth_left; // reusing a tombstone doesn't eat into the growth budget
+        }
+      _ctrl[slot] = h2 (hash);
+      _slots[slot] = std::move (e);
+    }
+
+    void erase (size_t slot)
+    {
+      // if the group still has an empty slot nobody ever probed past it, so we can skip the tombstone
+      if (match (&_ctrl[slot / _group_width * _group_width], _empty) != 0)
+        {
+          _ctrl[slot] = _empty;
+          ++_growth_left;
+        }
+      else
+        _ctrl[slot] = _deleted;
+      if constexpr (!std::is_trivially_destructible_v<entry>)
+        _slots[slot] = entry{};
+    }
+  };
+
+  Hash _hasher;
+  Eq _eq;
+  Alloc _alloc;
+  table _table;
+  table _old; // only non-empty while a resize is being spread across operations
+  size_t _migrated; // groups of _old already moved into _table
   size_t _size;
 
-  size_t hash_function (std::string const &key) const { return std::hash<std::string>{}(key) % _capacity; }
+  size_t hash_of (entry const &e) const
+  {
+    if constexpr (_store_hash)
+      return e._hash;
+    else
+      return _hasher (e._key);
+  }
+
+  // strings carrying an allocator get ours, so an arena backed map puts the key/value bytes in the arena too
+  template <typename T, typename View>
+  T make (View view) const
+  {
+    if constexpr (std::uses_allocator_v<T, Alloc>)
+      return T (view, typename T::allocator_type (_alloc));
+    else
+      return T (view);
+  }
+
+  entry make_entry (size_t hash, key_view key, value_view value) const
+  {
+    if constexpr (_store_hash)
+      return entry{hash, make<K> (key), make<V> (value)};
+    else
+      return entry{make<K> (key), make<V> (value)};
+  }
+
+  bool resizing () const { return _old.capacity () != 0; }
+
+  void migrate (size_t groups)
+  {
+    for (; groups > 0 && _migrated < _old.groups (); --groups, ++_migrated)
+      {
+        for (size_t i = _migrated * _group_width; i < (_migrated + 1) * _group_width; ++i)
+          {
+            if (_old._ctrl[i] < 0)
+              continue;
+            _table.insert (hash_of (_old._slots[i]), std::move (_old._slots[i]));
+            _old._ctrl[i] = _deleted; // lookups still probe through it, they just never match
+          }
+      }
+    if (_migrated == _old.groups ())
+      _old = table{_alloc};
+  }
+
+  void finish_migration () { migrate (_old.groups ()); }
+
+  // starts an incremental resize: the old entries stay where they are and get moved over a few groups at a time
+  void start_resize (size_t capacity)
+  {
+    finish_migration ();
+    _old = std::move (_table);
+    _table = table{capacity, _alloc};
+    _migrated = 0;
+  }
 
 public:
-  hashmap () : _buckets{}, _size{0} {}
+  explicit hashmap (Hash const &hasher = Hash{}, Eq const &eq = Eq{}, Alloc const &alloc = Alloc{})
+    : _hasher{hasher}, _eq{eq}, _alloc{alloc}, _table{_initial_capacity, alloc}, _old{alloc}, _migrated{0}, _size{0}
+  {}
+
+  explicit hashmap (Alloc const &alloc) : hashmap (Hash{}, Eq{}, alloc) {}
+
+  size_t hash (key_view key) const { return _hasher (key); }
+
+  bool put (key_view key, value_view value) { return put_hashed (key, _hasher (key), value); }
+
+  std::optional<V> get (key_view key) const
+  {
+    auto value = get_ptr (key);
+    if (value == nullptr)
+      return std::nullopt;
+    return *value;
+  }
+
+  // no copy: points into the table, valid until the next put/remove
+  V const *get_ptr (key_view key) const { return get_ptr_hashed (key, _hasher (key)); }
 
-  bool put (std::string const &key, std::string const &value)
+  bool remove (key_view key) { return remove_hashed (key, _hasher (key)); }
+
+  // the *_hashed versions take hash (key) computed up front, for callers that already needed it (sharding)
+  bool put_hashed (key_view key, size_t hash, value_view value)
   {
-    assert (!key.empty ());
-    assert (!value.empty ());
-    auto hash = hash_function (key);
-    auto &list = _buckets[hash];
-    auto it = std::find_if (list.begin (), list.end (), [&key] (auto const &arg) { return arg.first == key; });
-    if (it != list.end ())
+    if (resizing ())
+      migrate (_migrate_groups_per_op);
+    if (auto slot = _table.find (key, hash, _eq); slot != _npos)
+      {
+        _table._slots[slot]._value = value;
+        return true;
+      }
+    if (auto slot = _old.find (key, hash, _eq); slot != _npos)
       {
-        it->second = value;
+        _old._slots[slot]._value = value;
         return true;
       }
-    list.emplace_back (key, value);
+    if (_table._growth_left == 0)
+      {
+        // out of room: either we're really full (double) or it's mostly tombstones (same size, just clean up)
+        auto capacity = _table.capacity ();
+        start_resize (_size * 2 >= capacity - capacity / 8 ? capacity * 2 : capacity);
+        migrate (_migrate_groups_per_op);
+      }
+    _table.insert (hash, make_entry (hash, key, value));
     ++_size;
     return true;
   }
 
-  std::optional<std::string> get (std::string const &key) const
+  V const *get_ptr_hashed (key_view key, size_t hash) const
   {
-    assert (!key.empty ());
-    auto hash = hash_function (key);
-    auto &list = _buckets[hash];
-    auto it = std::find_if (list.begin (), list.end (), [&key] (auto const &arg) { return arg.first == key; });
-    if (it == list.end ())
-      return std::nullopt;
-    return it->second;
+    if (auto slot = _table.find (key, hash, _eq); slot != _npos)
+      return &_table._slots[slot]._value;
+    if (auto slot = _old.find (key, hash, _eq); slot != _npos)
+      return &_old._slots[slot]._value;
+    return nullptr;
   }
 
-  bool remove (std::string const &key)
+  bool remove_hashed (key_view key, size_t hash)
   {
-    assert (!key.empty ());
-    auto hash = hash_function (key);
-    auto &list = _buckets[hash];
-    auto it = std::find_if (list.begin (), list.end (), [&key] (auto const &arg) { return arg.first == key; });
-    if (it == list.end ())
+    if (resizing ())
+      migrate (_migrate_groups_per_op);
+    if (auto slot = _table.find (key, hash, _eq); slot != _npos)
+      _table.erase (slot);
+    else if (auto slot = _old.find (key, hash, _eq); slot != _npos)
+      _old.erase (slot);
+    else
       return false;
-    list.erase (it);
     --_size;
     return true;
   }
 
+  // pre-sizes for n entries in one go, meant for startup so nothing is spread out here
+  void reserve (size_t n)
+  {
+    auto capacity = capacity_for (n);
+    if (capacity <= _table.capacity ())
+      return;
+    start_resize (capacity);
+    finish_migration ();
+  }
+
+  // pairs with .first/.second (a vector of pairs, a std::map, ...): sized once up front so the whole load
+  // is a single pass with no resize in the middle
+  template <typename Range>
+  void insert_bulk (Range const &pairs)
+  {
+    reserve (_size + std::size (pairs));
+    for (auto const &[key, value] : pairs)
+      put (key, value);
+  }
+
+  // out[i] = get_ptr (keys[i]), software pipelined so the cache misses of different keys overlap: key i is
+  // hashed and its home control group prefetched, key i - _batch_width has its group matched against h2 and
+  // only the matching slots prefetched (the hit can be on any of the group's lines), and key
+  // i - 2 * _batch_width, whose lines should have landed by now, is looked up for real
+  void get_batch (batch_key const *keys, size_t n, V const **out) const
+  {
+    static size_t constexpr ring{4 * _batch_width};
+    size_t hashes[ring];
+    auto mask = _table.groups () - 1;
+    for (size_t i = 0; i < n + 2 * _batch_width; ++i)
+      {
+        if (i < n)
+          {
+            hashes[i % ring] = _hasher (keys[i]);
+            __builtin_prefetch (&_table._ctrl[((hashes[i % ring] >> 7) & mask) * _group_width]);
+          }
+        if (auto j = i - _batch_width; i >= _batch_width && j < n)
+          {
+            auto first = ((hashes[j % ring] >> 7) & mask) * _group_width;
+            for (auto bits = match (&_table._ctrl[first], h2 (hashes[j % ring])); bits != 0; bits &= bits - 1)
+              __builtin_prefetch (&_table._slots[first + __builtin_ctz (bits)]);
+          }
+        if (auto k = i - 2 * _batch_width; i >= 2 * _batch_width)
+          out[k] = get_ptr_hashed (keys[k], hashes[k % ring]);
+      }
+  }
+
+  double load_factor () const { return static_cast<double> (_size) / (_table.capacity () + _old.capacity ()); }
+
+  // writes the image hashmap_image::load_mmap serves from. the control bytes are laid out again for exactly
+  // size () entries, so saving a map that's half way through a resize is fine. false if the file can't be
+  // written or a key or value is too long for the image's 32-bit lengths
+  bool save (char const *path) const
+  {
+    static_assert (is_char_string<K>::value && is_char_string<V>::value, "only string maps have an image");
+    auto capacity = capacity_for (_size);
+    std::vector<int8_t> ctrl (capacity, _empty);
+    std::vector<image_slot> slots (capacity, image_slot{0, 0, 0, 0});
+    std::string strings;
+    for (auto const *t : {&_table, &_old})
+      {
+        for (size_t i = 0; i < t->capacity (); ++i)
+          {
+            if (t->_ctrl[i] < 0)
+              continue;
+            auto const &e = t->_slots[i];
+            if (e._key.size () > UINT32_MAX || e._value.size () > UINT32_MAX)
+              return false;
+            auto hash = hash_of (e);
+            auto slot = find_insert_slot (ctrl.data (), capacity / _group_width - 1, hash);
+            ctrl[slot] = h2 (hash);
+            slots[slot] = image_slot{hash, strings.size (), static_cast<uint32_t> (e._key.size ()),
+                                     static_cast<uint32_t> (e._value.size ())};
+            strings.append (e._key.data (), e._key.size ());
+            strings.append (e._value.data (), e._value.size ());
+          }
+      }
+    image_header header;
+    std::memcpy (header._magic, _image_magic, sizeof (_image_magic));
+    header._capacity = capacity;
+    header._size = _size;
+    header._ctrl_offset = 64;
+    header._slots_offset = (header._ctrl_offset + capacity + 63) & ~uint64_t{63};
+    header._strings_offset = header._slots_offset + capacity * sizeof (image_slot);
+    header._file_size = header._strings_offset + strings.size ();
+    header._hash_check = _hasher (_image_probe_key);
+    std::ofstream out (path, std::ios::binary | std::ios::trunc);
+    char padding[64]{};
+    out.write (reinterpret_cast<char const *> (&header), sizeof (header));
+    out.write (padding, header._ctrl_offset - sizeof (header));
+    out.write (reinterpret_cast<char const *> (ctrl.data ()), capacity);
+    out.write (padding, header._slots_offset - header._ctrl_offset - capacity);
+    out.write (reinterpret_cast<char const *> (slots.data ()), capacity * sizeof (image_slot));
+    out.write (strings.data (), strings.size ());
+    return static_cast<bool> (out.flush ());
+  }
+
   auto size () const { return _size; }
 
   auto empty () const { return size () == 0; }
 };
 
+// per-request scratch map: entries, control bytes and string bytes all come out of one arena
+template <typename K = arena_string, typename V = arena_string>
+using arena_hashmap = hashmap<K, V, fast_hash<K>, std::equal_to<>, arena_allocator<std::pair<K, V>>>;
+
+// read-only map served straight out of a file written by hashmap::save. load_mmap only checks the header,
+// nothing is parsed or copied, so opening costs the same for 10 entries or 10 million and a lookup touches
+// one control group, one slot and the key/value bytes. the image is trusted past the header
+template <typename Hash = fast_hash<std::string>>
+class hashmap_image
+{
+  void *_map;
+  size_t _len;
+  int8_t const *_ctrl;
+  image_slot const *_slots;
+  char const *_strings;
+  size_t _group_mask;
+  size_t _size;
+  Hash _hasher;
+
+  hashmap_image (void *map, size_t len, Hash const &hasher) : _map{map}, _len{len}, _hasher{hasher}
+  {
+    auto const *base = static_cast<char const *> (map);
+    auto const *header = reinterpret_cast<image_header const *> (base);
+    _ctrl = reinterpret_cast<int8_t const *> (base + header->_ctrl_offset);
+    _slots = reinterpret_cast<image_slot const *> (base + header->_slots_offset);
+    _strings = base + header->_strings_offset;
+    _group_mask = header->_capacity / _group_width - 1;
+    _size = header->_size;
+  }
+
+public:
+  // hasher has to hash like the one the map was saved with, an image from any other hash is refused
+  static std::optional<hashmap_image> load_mmap (char const *path, Hash const &hasher = Hash{})
+  {
+    int fd = open (path, O_RDONLY);
+    if (fd < 0)
+      return std::nullopt;
+    struct stat st;
+    if (fstat (fd, &st) != 0 || static_cast<size_t> (st.st_size) < sizeof (image_header))
+      {
+        close (fd);
+        return std::nullopt;
+      }
+    auto len = static_cast<size_t> (st.st_size);
+    auto *map = mmap (nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd); // the mapping keeps the file alive
+    if (map == MAP_FAILED)
+      return std::nullopt;
+    auto const *header = static_cast<image_header const *> (map);
+    auto capacity = header->_capacity;
+    if (std::memcmp (header->_magic, _image_magic, sizeof (_image_magic)) != 0 || header->_file_size != len
+        || capacity < _group_width || (capacity & (capacity - 1)) != 0 || header->_ctrl_offset + capacity > len
+        || header->_slots_offset + capacity * sizeof (image_slot) > header->_strings_offset
+        || header->_strings_offset > len || header->_hash_check != hasher (_image_probe_key))
+      {
+        munmap (map, len);
+        return std::nullopt;
+      }
+    return hashmap_image (map, len, hasher);
+  }
+
+  hashmap_image (hashmap_image &&other) noexcept
+    : _map{std::exchange (other._map, nullptr)}, _len{other._len}, _ctrl{other._ctrl}, _slots{other._slots},
+      _strings{other._strings}, _group_mask{other._group_mask}, _size{other._size}, _hasher{other._hasher}
+  {}
+
+  hashmap_image (hashmap_image const &) = delete;
+  hashmap_image &operator= (hashmap_image const &) = delete;
+  hashmap_image &operator= (hashmap_image &&) = delete;
+
+  ~hashmap_image ()
+  {
+    if (_map != nullptr)
+      munmap (_map, _len);
+  }
+
+  // the view points into the mapping, valid for as long as the image is alive
+  std::optional<std::string_view> get (std::string_view key) const
+  {
+    auto hash = _hasher (key);
+    auto group = (hash >> 7) & _group_mask;
+    for (size_t step = 1;; ++step)
+      {
+        auto const *ctrl = &_ctrl[group * _group_width];
+        for (auto bits = match (ctrl, h2 (hash)); bits != 0; bits &= bits - 1)
+          {
+            auto const &slot = _slots[group * _group_width + __builtin_ctz (bits)];
+            if (slot._hash == hash && std::string_view (_strings + slot._offset, slot._key_len) == key)
+              return std::string_view (_strings + slot._offset + slot._key_len, slot._value_len);
+          }
+        if (match (ctrl, _empty) != 0)
+          return std::nullopt;
+        group = (group + step) & _group_mask;
+      }
+  }
+
+  size_t size () const { return _size; }
+
+  bool empty () const { return size () == 0; }
+};
+
+// lock striping: the key space is split across independently locked shards so writers only block the
+// shard they touch and readers only ever take a shared lock. shards are picked with the top 16 bits of the
+// hash, the inner tables use the low ones, so both stay evenly spread. get copies the value out while the
+// lock is held, handing out pointers would race with the next writer
+template <typename K = std::string, typename V = std::string, typename Hash = fast_hash<K>,
+          typename Eq = std::equal_to<>, typename Alloc = std::allocator<std::pair<K, V>>>
+class concurrent_hashmap
+{
+  using map = hashmap<K, V, Hash, Eq, Alloc>;
+  using key_view = key_view_t<K>;
+  using value_view = key_view_t<V>;
+
+  // own cache line per shard, otherwise two threads hammering neighbouring locks fight over the same line
+  struct alignas (64) shard
+  {
+    mutable std::shared_mutex _mutex;
+    map _map;
+  };
+
+  Hash _hasher;
+  std::vector<shard> _shards;
+  size_t _mask;
+
+  shard &shard_for (size_t hash) { return _shards[(hash >> 48) & _mask]; }
+
+  shard const &shard_for (size_t hash) const { return _shards[(hash >> 48) & _mask]; }
+
+public:
+  // shard count is rounded up to a power of 2, at most 2^16 since the index comes from the top 16 bits
+  explicit concurrent_hashmap (uint32_t shards = 64, Hash const &hasher = Hash{}) : _hasher{hasher}
+  {
+    assert (shards > 0 && shards <= (1u << 16));
+    uint32_t n = 1;
+    while (n < shards)
+      n *= 2;
+    _shards = std::vector<shard> (n);
+    // the inner maps rehash with their own hasher when they resize, it has to be the one we route with
+    for (auto &s : _shards)
+      s._map = map (hasher);
+    _mask = n - 1;
+  }
+
+  bool put (key_view key, value_view value)
+  {
+    auto hash = _hasher (key);
+    auto &s = shard_for (hash);
+    std::unique_lock lock (s._mutex);
+    return s._map.put_hashed (key, hash, value);
+  }
+
+  std::optional<V> get (key_view key) const
+  {
+    auto hash = _hasher (key);
+    auto const &s = shard_for (hash);
+    std::shared_lock lock (s._mutex);
+    auto const *value = s._map.get_ptr_hashed (key, hash);
+    if (value == nullptr)
+      return std::nullopt;
+    return *value;
+  }
+
+  bool remove (key_view key)
+  {
+    auto hash = _hasher (key);
+    auto &s = shard_for (hash);
+    std::unique_lock lock (s._mutex);
+    return s._map.remove_hashed (key, hash);
+  }
+
+  // not a snapshot: shards are counted one at a time
+  size_t size () const
+  {
+    size_t total = 0;
+    for (auto const &s : _shards)
+      {
+        std::shared_lock lock (s._mutex);
+        total += s._map.size ();
+      }
+    return total;
+  }
+
+  bool empty () const { return size () == 0; }
+};
+
+// 90/10 get/put mix over a prefilled map, same start-signal trick as multithread_array_sum so thread
+// creation doesn't end up in the timing
+static void
+bench_concurrent_hashmap ()
+{
+  static uint64_t constexpr keys{1 << 16};
+  static uint64_t constexpr ops_per_thread{200'000};
+  concurrent_hashmap<uint64_t, uint64_t> m;
+  for (uint64_t k = 0; k < keys; ++k)
+    m.put (k, k);
+  auto max_threads = std::max (1u, std::thread::hardware_concurrency ());
+  for (uint32_t num_threads = 1;; num_threads = std::min (num_threads * 2, max_threads))
+    {
+      std::promise<void> start_promise;
+      std::shared_future<void> start_signal = start_promise.get_future ();
+      std::atomic<uint64_t> total_hits{0}, total_gets{0};
+      std::vector<std::thread> pool;
+      for (uint32_t t = 0; t < num_threads; ++t)
+        {
+          pool.emplace_back ([&m, &total_hits, &total_gets, start_signal, t] {
+            uint64_t x = 0x9e3779b97f4a7c15ull * (t + 1); // xorshift, <random> is way too slow for this
+            uint64_t hits = 0, gets = 0;
+            start_signal.wait ();
+            for (uint64_t i = 0; i < ops_per_thread; ++i)
+              {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                auto key = x % keys;
+                if (x % 10 == 0)
+                  m.put (key, i);
+                else
+                  {
+                    hits += m.get (key).has_value ();
+                    ++gets;
+                  }
+              }
+            total_hits += hits;
+            total_gets += gets;
+          });
+        }
+      auto start_time = std::chrono::high_resolution_clock::now ();
+      start_promise.set_value ();
+      for (auto &thread : pool)
+        thread.join ();
+      auto end_time = std::chrono::high_resolution_clock::now ();
+      // every key was put before the run and nothing removes, so every get has to hit
+      assert (total_hits == total_gets);
+      auto us = std::chrono::duration_cast<std::chrono::microseconds> (end_time - start_time).count ();
+      std::cout << num_threads << " thread(s): " << us << "us, "
+                << static_cast<double> (num_threads * ops_per_thread) / std::max<int64_t> (us, 1) << " ops/us, "
+                << total_hits << " hits\n";
+      if (num_threads == max_threads)
+        break;
+    }
+}
+
+// same random keys looked up one at a time vs through get_batch. the map is way bigger than the llc so
+// nearly every probe is a miss to dram, which is exactly what batching is supposed to hide
+static void
+bench_batched_lookup ()
+{
+  static uint64_t constexpr keys{1 << 21};
+  static size_t constexpr lookups{1 << 20};
+  static size_t constexpr batch{1'024};
+  hashmap<uint64_t, uint64_t> m;
+  std::vector<std::pair<uint64_t, uint64_t>> pairs (keys);
+  for (uint64_t k = 0; k < keys; ++k)
+    pairs[k] = {k * 0x9e3779b97f4a7c15ull, k};
+  m.insert_bulk (pairs);
+  std::vector<uint64_t> queries (lookups);
+  uint64_t x = 0x2545f4914f6cdd1dull;
+  for (auto &q : queries)
+    {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      q = (x % keys) * 0x9e3779b97f4a7c15ull;
+    }
+  std::vector<uint64_t const *> out (lookups);
+  uint64_t sum_single = 0, sum_batched = 0;
+  auto start_time = std::chrono::high_resolution_clock::now ();
+  for (size_t i = 0; i < lookups; ++i)
+    sum_single += *m.get_ptr (queries[i]);
+  auto mid_time = std::chrono::high_resolution_clock::now ();
+  for (size_t i = 0; i < lookups; i += batch)
+    m.get_batch (&queries[i], batch, &out[i]);
+  for (auto const *value : out)
+    sum_batched += *value;
+  auto end_time = std::chrono::high_resolution_clock::now ();
+  assert (sum_single == sum_batched);
+  auto single_us = std::chrono::duration_cast<std::chrono::microseconds> (mid_time - start_time).count ();
+  auto batched_us = std::chrono::duration_cast<std::chrono::microseconds> (end_time - mid_time).count ();
+  std::cout << "per-key lookups: " << single_us << "us, batched lookups: " << batched_us << "us (checksums "
+            << sum_single << ", " << sum_batched << ")\n";
+}
+
 int
 main ()
 {
@@ -144,7 +969,240 @@ main ()
     assert (m.get ("dug") == "two");
   }
 
+  {
+    // Way more keys than the initial capacity, plus churn so we go through tombstones.
+    hashmap m;
+    for (int i = 0; i < 10'000; ++i)
+      m.put ("key" + std::to_string (i), "value" + std::to_string (i));
+    assert (m.size () == 10'000);
+    for (int i = 0; i < 10'000; i += 2)
+      assert (m.remove ("key" + std::to_string (i)));
+    assert (m.size () == 5'000);
+    for (int i = 0; i < 10'000; ++i)
+      {
+        auto value = m.get ("key" + std::to_string (i));
+        if (i % 2 == 0)
+          assert (!value);
+        else
+          assert (value == "value" + std::to_string (i));
+      }
+    for (int round = 0; round < 20; ++round)
+      {
+        m.put ("churn", "x");
+        assert (m.remove ("churn"));
+      }
+    assert (m.size () == 5'000);
+  }
+
+  {
+    // Lookups and removes while a resize is still being spread across operations.
+    hashmap m;
+    for (int i = 0; i < 28; ++i)
+      m.put ("k" + std::to_string (i), "v" + std::to_string (i));
+    assert (m.load_factor () == 28.0 / 32);
+    m.put ("k28", "v28"); // kicks off the resize, most entries still live in the old table
+    for (int i = 0; i < 29; ++i)
+      assert (m.get ("k" + std::to_string (i)) == "v" + std::to_string (i));
+    assert (m.remove ("k27"));
+    assert (!m.get ("k27"));
+    m.put ("k0", "updated");
+    assert (m.get ("k0") == "updated");
+    assert (m.size () == 28);
+  }
+
+  {
+    // Pre-sizing.
+    hashmap m;
+    m.put ("before", "reserve");
+    m.reserve (1'000);
+    assert (m.get ("before") == "reserve");
+    assert (m.load_factor () < 0.01);
+    for (int i = 0; i < 1'000; ++i)
+      m.put (std::to_string (i), "x");
+    assert (m.size () == 1'001);
+    assert (m.load_factor () <= 7.0 / 8);
+  }
+
+  {
+    // Non-allocating lookups straight from a char buffer.
+    char buffer[] = "networkbytes";
+    hashmap m;
+    m.put (std::string_view (buffer, 7), "value");
+    assert (m.get (std::string_view (buffer, 7)) == "value");
+    assert (!m.get (std::string_view (buffer, 8)));
+    auto const *value = m.get_ptr (std::string_view (buffer, 7));
+    assert (value != nullptr && *value == "value");
+    assert (m.get_ptr ("missing") == nullptr);
+    assert (m.remove (std::string_view (buffer, 7)));
+    assert (m.empty ());
+  }
+
+  {
+    // Integer ids, no per-entry allocation anywhere.
+    hashmap<uint64_t, uint32_t> m;
+    for (uint64_t id = 0; id < 5'000; ++id)
+      m.put (id * 0x10001, static_cast<uint32_t> (id));
+    assert (m.size () == 5'000);
+    assert (m.get (1234 * 0x10001) == 1234u);
+    assert (!m.get (1234));
+    assert (m.remove (0));
+    assert (!m.get_ptr (0));
+  }
+
+  {
+    // Trivially copyable struct key with a caller supplied hash.
+    struct point
+    {
+      int32_t x;
+      int32_t y;
+      bool operator== (point const &other) const { return x == other.x && y == other.y; }
+    };
+    struct point_hash
+    {
+      size_t operator() (point const &p) const
+      {
+        return mum ((uint64_t (uint32_t (p.x)) << 32) | uint32_t (p.y), 0x9e3779b97f4a7c15ull);
+      }
+    };
+    hashmap<point, double, point_hash> m;
+    m.put ({1, 2}, 0.5);
+    m.put ({2, 1}, 1.5);
+    assert (m.get ({1, 2}) == 0.5);
+    assert (m.get ({2, 1}) == 1.5);
+    assert (!m.get ({1, 1}));
+  }
+
+  {
+    // Sharded map, hammered from a few threads at once.
+    concurrent_hashmap m (4);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < 4; ++t)
+      {
+        pool.emplace_back ([&m, t] {
+          for (int i = 0; i < 1'000; ++i)
+            {
+              auto key = std::to_string (t) + ":" + std::to_string (i);
+              m.put (key, "v");
+              assert (m.get (key) == "v");
+              if (i % 2 == 0)
+                assert (m.remove (key));
+            }
+        });
+      }
+    for (auto &thread : pool)
+      thread.join ();
+    assert (m.size () == 2'000);
+    assert (m.get ("3:999") == "v");
+    assert (!m.get ("3:998"));
+    concurrent_hashmap<int, int> single (1);
+    single.put (1, 2);
+    assert (single.get (1) == 2);
+  }
+
+  {
+    // Sharded map with a stateful hash, grown through several resizes: the shards have to rehash with the
+    // same seed they were probed with.
+    struct seeded
+    {
+      uint64_t _seed;
+      size_t operator() (uint64_t key) const { return mum (key ^ _seed, 0x9e3779b97f4a7c15ull); }
+    };
+    concurrent_hashmap<uint64_t, uint64_t, seeded> m (1, seeded{0x5eed5eed5eedull});
+    for (uint64_t i = 0; i < 10'000; ++i)
+      m.put (i, i * 3);
+    for (uint64_t i = 0; i < 10'000; ++i)
+      assert (m.get (i) == i * 3);
+    assert (m.size () == 10'000);
+  }
+
+  {
+    // Bulk load and batched lookups.
+    std::vector<std::pair<std::string, std::string>> pairs;
+    for (int i = 0; i < 100; ++i)
+      pairs.emplace_back ("bulk" + std::to_string (i), std::to_string (i));
+    hashmap m;
+    m.put ("bulk7", "stale");
+    m.insert_bulk (pairs);
+    assert (m.size () == 100);
+    assert (m.get ("bulk7") == "7");
+    std::vector<std::string_view> keys{"bulk0", "nope", "bulk99", "bulk50"};
+    std::vector<std::string const *> out (keys.size ());
+    m.get_batch (keys.data (), keys.size (), out.data ());
+    assert (out[0] != nullptr && *out[0] == "0");
+    assert (out[1] == nullptr);
+    assert (out[2] != nullptr && *out[2] == "99");
+    assert (out[3] != nullptr && *out[3] == "50");
+  }
+
+  {
+    // Arena backed scratch maps, built and thrown away with a single arena_free.
+    static size_t constexpr buf_len{1 << 20};
+    auto *buf = static_cast<unsigned char *> (std::malloc (buf_len));
+    arena a;
+    arena_init (&a, buf, buf_len);
+    for (int request = 0; request < 3; ++request)
+      {
+        {
+          arena_hashmap<> m{arena_allocator<std::pair<arena_string, arena_string>> (&a)};
+          for (int i = 0; i < 500; ++i)
+            m.put ("a key long enough to skip sso " + std::to_string (i), "and a value that is long too");
+          assert (m.size () == 500);
+          auto const *value = m.get_ptr ("a key long enough to skip sso 42");
+          assert (value != nullptr && *value == "and a value that is long too");
+          auto const *bytes = reinterpret_cast<unsigned char const *> (value->data ());
+          assert (bytes >= buf && bytes < buf + buf_len);
+          assert (m.remove ("a key long enough to skip sso 42"));
+          assert (!m.get ("a key long enough to skip sso 42"));
+        }
+        assert (a.curr_offset > 0);
+        arena_free (&a);
+      }
+    std::free (buf);
+  }
+
+  {
+    // Snapshot to disk and serve lookups straight from the mapping, saved in the middle of a resize.
+    hashmap m;
+    for (int i = 0; i < 29; ++i)
+      m.put ("snap" + std::to_string (i), "shot" + std::to_string (i));
+    assert (m.remove ("snap3"));
+    char const *path = "/tmp/hashmap_test.img";
+    assert (m.save (path));
+    {
+      auto image = hashmap_image<>::load_mmap (path);
+      assert (image);
+      assert (image->size () == 28);
+      assert (image->get ("snap0") == "shot0");
+      assert (image->get ("snap28") == "shot28");
+      assert (!image->get ("snap3"));
+      assert (!image->get ("nope"));
+    }
+    hashmap empty_map;
+    assert (empty_map.save (path));
+    auto empty_image = hashmap_image<>::load_mmap (path);
+    assert (empty_image && empty_image->empty () && !empty_image->get ("x"));
+
+    // an image only probes right with the hash it was saved with, anything else is refused up front
+    struct seeded
+    {
+      uint64_t _seed;
+      size_t operator() (std::string_view key) const { return hash_bytes (key.data (), key.size ()) ^ _seed; }
+    };
+    hashmap<std::string, std::string, seeded> seeded_map (seeded{42});
+    seeded_map.put ("seeded", "map");
+    assert (seeded_map.save (path));
+    assert (!hashmap_image<>::load_mmap (path));
+    assert (!hashmap_image<seeded>::load_mmap (path, seeded{7}));
+    auto seeded_image = hashmap_image<seeded>::load_mmap (path, seeded{42});
+    assert (seeded_image && seeded_image->get ("seeded") == "map");
+    std::remove (path);
+    assert (!hashmap_image<>::load_mmap (path));
+  }
+
   std::cout << "All tests passed!\n";
 
+  bench_concurrent_hashmap ();
+  bench_batched_lookup ();
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,138 @@
+#ifndef INDEXED_HEAP_H
+#define INDEXED_HEAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//
+// binary_min_heap grown up for shortest paths: D children per node instead of two (a 4-ary heap is half as
+// deep and its children sit next to each other in memory), any priority type, and items are ids in
+// [0, items) whose slot in the heap is tracked so decrease_key can find them without a search.
+// the root is at 0 here, the children of hole are D * hole + 1 .. D * hole + D
+//
+template <typename Priority, unsigned D = 4, typename Less = std::less<Priority>>
+class indexed_dary_heap
+{
+  static_assert (D >= 2, "a heap needs at least two children per node");
+
+  static uint32_t constexpr _absent{~0u};
+
+  struct entry
+  {
+    Priority _priority;
+    uint32_t _item;
+  };
+
+  std::vector<entry> _data;
+  std::vector<uint32_t> _position; // item -> slot in _data, _absent when it isn't queued
+  Less _less;
+
+  void place (size_t hole, entry const &e)
+  {
+    _data[hole] = e;
+    _position[e._item] = static_cast<uint32_t> (hole);
+  }
+
+  void percolate_up (size_t hole)
+  {
+    auto hole_value = _data[hole];
+    for (; hole > 0 && _less (hole_value._priority, _data[(hole - 1) / D]._priority); hole = (hole - 1) / D)
+      place (hole, _data[(hole - 1) / D]);
+    place (hole, hole_value);
+  }
+
+  void percolate_down (size_t hole)
+  {
+    auto hole_value = _data[hole];
+    for (;;)
+      {
+        auto first = hole * D + 1;
+        if (first >= _data.size ())
+          break;
+        auto last = std::min (first + D, _data.size ());
+        auto child = first;
+        for (auto c = first + 1; c < last; ++c)
+          if (_less (_data[c]._priority, _data[child]._priority))
+            child = c;
+        if (!_less (_data[child]._priority, hole_value._priority))
+          break;
+        place (hole, _data[child]);
+        hole = child;
+      }
+    place (hole, hole_value);
+  }
+
+public:
+  explicit indexed_dary_heap (uint32_t items, Less less = Less ()) : _position (items, _absent), _less{less} {}
+
+  ~indexed_dary_heap () = default;
+
+  // false if item is already queued, use decrease_key for that
+  bool insert (uint32_t item, Priority priority)
+  {
+    if (contains (item))
+      return false;
+    _data.push_back ({priority, item});
+    percolate_up (_data.size () - 1);
+    return true;
+  }
+
+  // false if item isn't queued or priority wouldn't lower it
+  bool decrease_key (uint32_t item, Priority priority)
+  {
+    if (!contains (item) || !_less (priority, _data[_position[item]]._priority))
+      return false;
+    _data[_position[item]]._priority = priority;
+    percolate_up (_position[item]);
+    return true;
+  }
+
+  // insert or decrease_key, whichever applies. true if the heap changed
+  bool push_or_decrease (uint32_t item, Priority priority)
+  {
+    return contains (item) ? decrease_key (item, priority) : insert (item, priority);
+  }
+
+  std::optional<std::pair<uint32_t, Priority>> get_min () const
+  {
+    if (empty ())
+      return std::nullopt;
+    return std::pair{_data[0]._item, _data[0]._priority};
+  }
+
+  bool delete_min ()
+  {
+    if (empty ())
+      return false;
+    _position[_data[0]._item] = _absent;
+    if (_data.size () > 1)
+      {
+        _data[0] = _data.back ();
+        _data.pop_back ();
+        percolate_down (0);
+      }
+    else
+      _data.pop_back ();
+    return true;
+  }
+
+  bool contains (uint32_t item) const { return _position[item] != _absent; }
+
+  // only touches what is still queued, so reusing one heap across many searches stays cheap
+  void clear ()
+  {
+    for (auto const &e : _data)
+      _position[e._item] = _absent;
+    _data.clear ();
+  }
+
+  size_t size () const { return _data.size (); }
+
+  bool empty () const { return size () == 0; }
+};
+
+#endif
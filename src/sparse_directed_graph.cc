@@ -1,59 +1,344 @@
 #include <cassert>
 #include <unordered_map>
-#include <unordered_set>
 #include <algorithm>
 #include <iostream>
-#include <queue>
+#include <vector>
+#include <string>
+#include <optional>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <limits>
+#include <cmath>
 
+#include "graph_traversal.h"
+#include "indexed_heap.h"
+
+// csr_view plus one weight per edge, _weights[e] goes with _edges._targets[e]
+struct weighted_csr_view
+{
+  csr_view _edges;
+  double const *_weights;
+};
+
+// any heuristic is fine as long as it never overestimates, this one turns A* back into Dijkstra
+struct no_heuristic
+{
+  double operator() (uint32_t) const { return 0.0; }
+};
+
+//
+// Dijkstra and A* over a weighted_csr_view, keeping everything a query needs so a stream of queries doesn't
+// allocate: distances and parents only get reset for the vertices the previous query touched, and the heap
+// is an indexed_dary_heap whose decrease_key replaces the usual duplicate queue entries. with a heuristic
+// the queue is ordered by distance so far plus the guess for the rest. a vertex that gets a shorter distance
+// after it was popped (heuristics that aren't consistent) is just queued again
+//
+class path_search
+{
+  indexed_dary_heap<double, 4> _heap;
+  std::vector<double> _distance;
+  std::vector<uint32_t> _parent;
+  std::vector<uint32_t> _touched;
+
+public:
+  explicit path_search (uint32_t n)
+    : _heap (n), _distance (n, std::numeric_limits<double>::infinity ()), _parent (n, unreached)
+  {
+  }
+
+  // distance from source to target, nullopt if it can't be reached. with target unreached it settles every
+  // vertex it can reach and returns nullopt, read the results through distance () and parent ()
+  template <typename Heuristic = no_heuristic>
+  std::optional<double> run (weighted_csr_view const &graph, uint32_t source, uint32_t target,
+                             Heuristic &&heuristic = {})
+  {
+    for (auto v : _touched)
+      {
+        _distance[v] = std::numeric_limits<double>::infinity ();
+        _parent[v] = unreached;
+      }
+    _touched.clear ();
+    _heap.clear ();
+
+    auto const &edges = graph._edges;
+    _distance[source] = 0.0;
+    _parent[source] = source;
+    _touched.push_back (source);
+    _heap.insert (source, heuristic (source));
+    while (!_heap.empty ())
+      {
+        auto v = _heap.get_min ()->first;
+        _heap.delete_min ();
+        if (v == target)
+          {
+            return _distance[v];
+          }
+        for (auto e = edges._offsets[v]; e < edges._offsets[v + 1]; ++e)
+          {
+            auto w = edges._targets[e];
+            auto d = _distance[v] + graph._weights[e];
+            if (d < _distance[w])
+              {
+                if (_parent[w] == unreached)
+                  {
+                    _touched.push_back (w);
+                  }
+                _distance[w] = d;
+                _parent[w] = v;
+                _heap.push_or_decrease (w, d + heuristic (w));
+              }
+          }
+      }
+    return std::nullopt;
+  }
+
+  double distance (uint32_t v) const { return _distance[v]; }
+
+  uint32_t parent (uint32_t v) const { return _parent[v]; }
+
+  // source .. target from the last run, empty if target wasn't reached
+  std::vector<uint32_t> path (uint32_t target) const
+  {
+    std::vector<uint32_t> result;
+    if (_parent[target] == unreached)
+      {
+        return result;
+      }
+    for (auto v = target;; v = _parent[v])
+      {
+        result.push_back (v);
+        if (_parent[v] == v)
+          {
+            break;
+          }
+      }
+    std::reverse (result.begin (), result.end ());
+    return result;
+  }
+};
+
+//
+// read-only snapshot of a sparse_directed_graph in compressed sparse row form: vertex names are interned
+// to dense ids (in insertion order, so traversals visit things in the same order as the graph they came
+// from), and the out edges of vertex v are _targets[_offsets[v] .. _offsets[v + 1]). traversals run on
+// the ids and flat arrays, no hashing and no string copies per step. the in edges are kept too, in the
+// same layout, because the bottom-up half of bfs_tree walks them
+//
+class frozen_directed_graph final
+{
+  friend class sparse_directed_graph;
+
+  std::vector<std::string> _names;
+  std::unordered_map<std::string, uint32_t> _ids;
+  std::vector<uint64_t> _offsets;
+  std::vector<uint32_t> _targets;
+  std::vector<double> _weights;
+  std::vector<uint64_t> _in_offsets;
+  std::vector<uint32_t> _sources;
+
+public:
+  csr_view view () const { return csr_view{vertex_count (), _offsets.data (), _targets.data ()}; }
+
+  weighted_csr_view weighted_view () const { return weighted_csr_view{view (), _weights.data ()}; }
+
+  // weighted distance from source to target (Dijkstra, or A* given a heuristic), see path_search
+  template <typename Heuristic = no_heuristic>
+  std::optional<double> shortest_path (uint32_t source, uint32_t target, path_search &search,
+                                       Heuristic &&heuristic = {}) const
+  {
+    return search.run (weighted_view (), source, target, heuristic);
+  }
+
+  double weight (uint32_t src, uint32_t dst) const
+  {
+    auto const *first = _targets.data () + _offsets[src];
+    auto const *last = _targets.data () + _offsets[src + 1];
+    auto it = std::find (first, last, dst);
+    return it == last ? std::numeric_limits<double>::infinity () : _weights[it - _targets.data ()];
+  }
+
+  uint32_t vertex_count () const { return static_cast<uint32_t> (_names.size ()); }
+
+  uint64_t edge_count () const { return _targets.size (); }
+
+  std::optional<uint32_t> id (std::string const &vertex) const
+  {
+    auto it = _ids.find (vertex);
+    if (it == _ids.end ())
+      {
+        return std::nullopt;
+      }
+    return it->second;
+  }
+
+  std::string const &name (uint32_t v) const { return _names[v]; }
+
+  bool has_edge (uint32_t src, uint32_t dst) const
+  {
+    auto const *first = _targets.data () + _offsets[src];
+    auto const *last = _targets.data () + _offsets[src + 1];
+    return std::find (first, last, dst) != last;
+  }
+
+  // depth first over the ids with a graph_visitor (see graph_traversal.h), from every vertex or just root
+  template <typename Visitor> bool for_each_dfs (Visitor &&visitor, uint32_t root = unreached) const
+  {
+    traversal_scratch scratch;
+    return ::for_each_dfs (view (), scratch, visitor, root);
+  }
+
+  template <typename Visitor> bool for_each_bfs (Visitor &&visitor, uint32_t root = unreached) const
+  {
+    traversal_scratch scratch;
+    return ::for_each_bfs (view (), scratch, visitor, root);
+  }
+
+  // distance and parent of every vertex from source, see direction_optimizing_bfs
+  bfs_result bfs_tree (uint32_t source, bfs_options const &options = {}) const
+  {
+    csr_view in{vertex_count (), _in_offsets.data (), _sources.data ()};
+    return direction_optimizing_bfs (view (), in, source, options);
+  }
+
+  // ids ordered so every edge points forward (Kahn's), nullopt when a cycle makes that impossible
+  std::optional<std::vector<uint32_t>> topological_order () const
+  {
+    std::vector<uint32_t> order;
+    if (!::topological_order (view (), order))
+      {
+        return std::nullopt;
+      }
+    return order;
+  }
+
+  // strongly connected components and the dag between them, see condense in graph_traversal.h
+  condensation condense () const { return ::condense (view ()); }
+
+  bool has_cycle () const
+  {
+    traversal_scratch scratch;
+    std::vector<uint32_t> cycle;
+    return ::find_cycle<true> (view (), scratch, cycle);
+  }
+
+  // ids of some cycle in edge order, the last one points back at the first. reuse scratch and cycle between
+  // calls and nothing gets allocated
+  bool find_cycle (traversal_scratch &scratch, std::vector<uint32_t> &cycle) const
+  {
+    return ::find_cycle<true> (view (), scratch, cycle);
+  }
+};
+
+//
+// vertex names are interned to dense uint32_t ids (in insertion order, removed ids are never handed out
+// again) and the out edges are per-id vectors of ids, so traversals don't hash a single string
+//
 class sparse_directed_graph final
 {
-  std::vector<std::string> _vertices;
-  std::unordered_map<std::string, std::vector<std::string>> _list;
+  std::vector<std::string> _names; // id -> name, empty for removed vertices
+  std::unordered_map<std::string, uint32_t> _ids;
+  std::vector<std::vector<uint32_t>> _adjacency;
+  std::vector<std::vector<double>> _weights; // lines up with _adjacency edge for edge
+  std::vector<bool> _alive;
+  size_t _vertex_count{0};
+
+  adjacency_list_view view () const { return adjacency_list_view{&_adjacency, &_alive}; }
+
+  void erase_edge (uint32_t src, uint32_t dst)
+  {
+    auto &targets = _adjacency[src];
+    auto &weights = _weights[src];
+    size_t kept = 0;
+    for (size_t e = 0; e < targets.size (); ++e)
+      {
+        if (targets[e] != dst)
+          {
+            targets[kept] = targets[e];
+            weights[kept++] = weights[e];
+          }
+      }
+    targets.resize (kept);
+    weights.resize (kept);
+  }
 
 public:
+  std::optional<uint32_t> id (std::string const &vertex) const
+  {
+    auto it = _ids.find (vertex);
+    if (it == _ids.end ())
+      {
+        return std::nullopt;
+      }
+    return it->second;
+  }
+
+  std::string const &name (uint32_t v) const { return _names[v]; }
+
   bool add_vertex (std::string const &vertex)
   {
     assert (!vertex.empty ());
-    if (_list.find (vertex) != _list.end ())
+    if (_ids.find (vertex) != _ids.end ())
       {
         return false;
       }
-    _vertices.emplace_back (vertex);
-    _list[vertex] = std::vector<std::string> ();
+    _ids.emplace (vertex, static_cast<uint32_t> (_names.size ()));
+    _names.emplace_back (vertex);
+    _adjacency.emplace_back ();
+    _weights.emplace_back ();
+    _alive.push_back (true);
+    ++_vertex_count;
     return true;
   }
 
+  // nobody keeps track of in edges, so this one still has to look at every list
   bool remove_vertex (std::string const &vertex)
   {
     assert (!vertex.empty ());
-    if (_list.find (vertex) == _list.end ())
+    auto it = _ids.find (vertex);
+    if (it == _ids.end ())
       {
         return false;
       }
-    _vertices.erase (std::remove (_vertices.begin (), _vertices.end (), vertex));
-    _list.erase (vertex);
-    for (auto &[_, v] : _list)
+    auto v = it->second;
+    _ids.erase (it);
+    _names[v] = std::string ();
+    _adjacency[v] = std::vector<uint32_t> ();
+    _weights[v] = std::vector<double> ();
+    _alive[v] = false;
+    --_vertex_count;
+    for (uint32_t u = 0; u < _adjacency.size (); ++u)
       {
-        v.erase (std::remove (v.begin (), v.end (), vertex), v.end ());
+        erase_edge (u, v);
       }
     return true;
   }
 
-  bool add_edge (std::string const &src, std::string const &dst)
+  // weight only matters to the shortest path searches on the frozen form, and those need it to be >= 0
+  bool add_edge (std::string const &src, std::string const &dst, double weight = 1.0)
   {
     assert (!src.empty ());
     assert (!dst.empty ());
-    auto src_it = _list.find (src);
-    if (src_it == _list.end () || _list.find (dst) == _list.end ())
+    assert (weight >= 0.0);
+    auto s = id (src);
+    auto d = id (dst);
+    if (!s || !d)
       {
         return false;
       }
-    auto &vec = src_it->second;
-    if (std::find (vec.begin (), vec.end (), dst) != vec.end ())
+    auto &vec = _adjacency[*s];
+    if (std::find (vec.begin (), vec.end (), *d) != vec.end ())
       {
         return false;
       }
-    vec.emplace_back (dst);
+    vec.emplace_back (*d);
+    _weights[*s].emplace_back (weight);
     return true;
   }
 
@@ -61,130 +346,552 @@ public:
   {
     assert (!src.empty ());
     assert (!dst.empty ());
-    auto src_it = _list.find (src);
-    if (src_it == _list.end () || _list.find (dst) == _list.end ())
+    auto s = id (src);
+    auto d = id (dst);
+    if (!s || !d)
       {
         return false;
       }
-    auto &vec = src_it->second;
-    vec.erase (std::remove (vec.begin (), vec.end (), dst), vec.end ());
+    erase_edge (*s, *d);
     return true;
   }
 
-  void dfs_helper (std::string const &vertex, std::unordered_set<std::string> &visited) const
+  // depth first over the ids with a graph_visitor (see graph_traversal.h), from every vertex or just root
+  template <typename Visitor> bool for_each_dfs (Visitor &&visitor, uint32_t root = unreached) const
+  {
+    traversal_scratch scratch;
+    return ::for_each_dfs (view (), scratch, visitor, root);
+  }
+
+  template <typename Visitor> bool for_each_bfs (Visitor &&visitor, uint32_t root = unreached) const
   {
-    visited.emplace (vertex);
-    std::cout << vertex << ' ';
-    for (auto const &edge : _list.at (vertex))
+    traversal_scratch scratch;
+    return ::for_each_bfs (view (), scratch, visitor, root);
+  }
+
+  // ids ordered so every edge points forward (Kahn's), nullopt when a cycle makes that impossible
+  std::optional<std::vector<uint32_t>> topological_order () const
+  {
+    std::vector<uint32_t> order;
+    if (!::topological_order (view (), order))
       {
-        if (visited.count (edge) == 0)
-          {
-            dfs_helper (edge, visited);
-          }
+        return std::nullopt;
       }
+    return order;
+  }
+
+  // strongly connected components and the dag between them, see condense in graph_traversal.h
+  condensation condense () const { return ::condense (view ()); }
+
+  bool has_cycle () const
+  {
+    traversal_scratch scratch;
+    std::vector<uint32_t> cycle;
+    return ::find_cycle<true> (view (), scratch, cycle);
   }
 
-  void dfs () const
+  // the vertices of some cycle in edge order (the last one points back at the first), empty if there's none
+  std::vector<std::string> find_cycle () const
   {
-    std::unordered_set<std::string> visited;
-    for (auto const &vertex : _vertices)
+    traversal_scratch scratch;
+    std::vector<uint32_t> cycle;
+    ::find_cycle<true> (view (), scratch, cycle);
+    std::vector<std::string> names;
+    for (auto v : cycle)
       {
-        if (visited.count (vertex) == 0)
-          {
-            dfs_helper (vertex, visited);
-          }
+        names.push_back (_names[v]);
       }
-    std::cout << '\n';
+    return names;
   }
 
-  void bfs () const
+  bool has_edge (std::string const &src, std::string const &dst) const
   {
-    std::queue<std::string> curr_vertices;
-    std::unordered_set<std::string> visited;
-    for (auto const &vertex : _vertices)
+    assert (!src.empty ());
+    assert (!dst.empty ());
+    auto s = id (src);
+    auto d = id (dst);
+    if (!s || !d)
       {
-        if (visited.count (vertex) == 0)
-          {
-            visited.emplace (vertex);
-            curr_vertices.emplace (vertex);
-
-            while (!curr_vertices.empty ())
-              {
-                auto curr = curr_vertices.front ();
-                curr_vertices.pop ();
-                std::cout << curr << ' ';
-                for (auto const &edge : _list.at (curr))
-                  {
-                    if (visited.count (edge) == 0)
-                      {
-                        visited.emplace (edge);
-                        curr_vertices.emplace (edge);
-                      }
-                  }
-              }
-          }
+        return false;
       }
-    std::cout << '\n';
+    auto &vec = _adjacency[*s];
+    return std::find (vec.begin (), vec.end (), *d) != vec.end ();
   }
 
-  bool has_cycle_helper (std::string const &vertex, std::unordered_set<std::string> &visited,
-                         std::unordered_set<std::string> &path) const
+  bool empty () const { return _vertex_count == 0; }
+
+  // csr snapshot for heavy traversal work, see frozen_directed_graph. later changes to this graph don't show up
+  frozen_directed_graph freeze () const
   {
-    visited.emplace (vertex);
-    path.emplace (vertex);
-    for (auto const &edge : _list.at (vertex))
+    frozen_directed_graph g;
+    std::vector<uint32_t> compact (_names.size (), unreached); // removed ids leave holes, the snapshot has none
+    for (uint32_t v = 0; v < _names.size (); ++v)
       {
-        if (visited.count (edge) == 0)
+        if (_alive[v])
           {
-            if (has_cycle_helper (edge, visited, path))
-              {
-                return true;
-              }
+            compact[v] = static_cast<uint32_t> (g._names.size ());
+            g._ids.emplace (_names[v], compact[v]);
+            g._names.push_back (_names[v]);
           }
-        else if (path.count (edge) > 0)
+      }
+    g._offsets.reserve (g._names.size () + 1);
+    g._offsets.push_back (0);
+    for (uint32_t v = 0; v < _names.size (); ++v)
+      {
+        if (!_alive[v])
           {
-            return true;
+            continue;
           }
+        for (auto edge : _adjacency[v])
+          {
+            g._targets.push_back (compact[edge]);
+          }
+        g._weights.insert (g._weights.end (), _weights[v].begin (), _weights[v].end ());
+        g._offsets.push_back (g._targets.size ());
       }
-    path.erase (vertex);
-    return false;
+    g._in_offsets.assign (g._names.size () + 1, 0);
+    for (auto target : g._targets)
+      {
+        ++g._in_offsets[target + 1];
+      }
+    for (size_t v = 0; v < g._names.size (); ++v)
+      {
+        g._in_offsets[v + 1] += g._in_offsets[v];
+      }
+    g._sources.resize (g._targets.size ());
+    auto fill = g._in_offsets;
+    for (uint32_t v = 0; v < g._names.size (); ++v)
+      {
+        for (auto e = g._offsets[v]; e < g._offsets[v + 1]; ++e)
+          {
+            g._sources[fill[g._targets[e]]++] = v;
+          }
+      }
+    return g;
   }
+};
 
-  bool has_cycle () const
+struct worker_stats
+{
+  uint64_t _tasks;
+  uint64_t _steals;
+  uint64_t _busy_ns;
+  double _utilization; // busy time over wall time
+};
+
+struct schedule_report
+{
+  uint64_t _wall_ns;
+  uint32_t _critical_path_tasks; // most tasks on one chain of dependencies
+  uint64_t _critical_path_ns;    // most task time on one chain, nothing can finish faster than this
+  std::vector<worker_stats> _workers;
+};
+
+//
+// runs every vertex of a dag as task (v, worker) on a pool of threads, a task becoming ready once all of its
+// predecessors are done. each vertex has an atomic in-degree, whoever brings it to zero pushes the vertex onto
+// its own ready deque. owners work off the back of their deque (the task they just freed is still warm in
+// cache), idle workers steal from the front of somebody else's. the threads live for the whole run, a task
+// costs a couple of atomics and an uncontended lock, never a thread or a future. nullopt and nothing runs if
+// the graph has a cycle
+//
+template <typename Task>
+std::optional<schedule_report>
+run_task_graph (csr_view const &graph, unsigned threads, Task &&task)
+{
+  using clock = std::chrono::steady_clock;
+  auto since = [] (clock::time_point start) {
+    auto took = std::chrono::duration_cast<std::chrono::nanoseconds> (clock::now () - start);
+    return static_cast<uint64_t> (took.count ());
+  };
+
+  struct alignas (64) worker
   {
-    std::unordered_set<std::string> visited;
-    std::unordered_set<std::string> path;
-    for (auto const &vertex : _vertices)
+    std::mutex _lock;
+    std::deque<uint32_t> _ready;
+    uint64_t _tasks{0};
+    uint64_t _steals{0};
+    uint64_t _busy_ns{0};
+  };
+
+  auto n = graph.vertex_count ();
+  std::vector<uint32_t> order;
+  if (!topological_order (graph, order))
+    {
+      return std::nullopt;
+    }
+
+  schedule_report report{0, 0, 0, {}};
+  std::vector<uint32_t> depth (n, 1);
+  for (auto v : order)
+    {
+      graph.for_each_edge (v, [&] (uint32_t w) { return depth[w] = std::max (depth[w], depth[v] + 1), false; });
+      report._critical_path_tasks = std::max (report._critical_path_tasks, depth[v]);
+    }
+
+  threads = std::max (1u, threads);
+  std::unique_ptr<std::atomic<uint32_t>[]> in_degree (new std::atomic<uint32_t>[n]);
+  std::unique_ptr<std::atomic<uint64_t>[]> ready_at (new std::atomic<uint64_t>[n]); // heaviest chain into v
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      in_degree[v].store (0, std::memory_order_relaxed);
+      ready_at[v].store (0, std::memory_order_relaxed);
+    }
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      graph.for_each_edge (v, [&] (uint32_t w) {
+        in_degree[w].fetch_add (1, std::memory_order_relaxed);
+        return false;
+      });
+    }
+
+  std::vector<worker> workers (threads);
+  uint32_t next_worker = 0;
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      if (in_degree[v].load (std::memory_order_relaxed) == 0)
+        {
+          workers[next_worker]._ready.push_back (v);
+          next_worker = (next_worker + 1) % threads;
+        }
+    }
+
+  std::atomic<uint32_t> remaining{n};
+  std::atomic<uint64_t> critical_ns{0};
+  auto atomic_max = [] (std::atomic<uint64_t> &slot, uint64_t value) {
+    for (auto seen = slot.load (std::memory_order_relaxed);
+         seen < value && !slot.compare_exchange_weak (seen, value, std::memory_order_relaxed);)
+      {
+      }
+  };
+
+  auto work = [&] (unsigned id) {
+    auto &self = workers[id];
+    while (remaining.load (std::memory_order_acquire) > 0)
       {
-        if (visited.count (vertex) == 0)
+        uint32_t v = unreached;
+        {
+          std::lock_guard<std::mutex> lock (self._lock);
+          if (!self._ready.empty ())
+            {
+              v = self._ready.back ();
+              self._ready.pop_back ();
+            }
+        }
+        for (unsigned i = 1; v == unreached && i < threads; ++i)
           {
-            if (has_cycle_helper (vertex, visited, path))
+            auto &victim = workers[(id + i) % threads];
+            std::lock_guard<std::mutex> lock (victim._lock);
+            if (!victim._ready.empty ())
               {
-                return true;
+                v = victim._ready.front ();
+                victim._ready.pop_front ();
+                ++self._steals;
               }
           }
+        if (v == unreached)
+          {
+            std::this_thread::yield ();
+            continue;
+          }
+
+        auto start = clock::now ();
+        task (v, id);
+        auto took = since (start);
+        self._busy_ns += took;
+        ++self._tasks;
+
+        auto done_at = ready_at[v].load (std::memory_order_relaxed) + took;
+        atomic_max (critical_ns, done_at);
+        graph.for_each_edge (v, [&] (uint32_t w) {
+          atomic_max (ready_at[w], done_at);
+          if (in_degree[w].fetch_sub (1, std::memory_order_acq_rel) == 1)
+            {
+              std::lock_guard<std::mutex> lock (self._lock);
+              self._ready.push_back (w);
+            }
+          return false;
+        });
+        remaining.fetch_sub (1, std::memory_order_release);
       }
+  };
+
+  auto start = clock::now ();
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; ++t)
+    {
+      pool.emplace_back (work, t);
+    }
+  work (0);
+  for (auto &t : pool)
+    {
+      t.join ();
+    }
+  report._wall_ns = since (start);
+  report._critical_path_ns = critical_ns.load ();
+  for (auto const &w : workers)
+    {
+      report._workers.push_back ({w._tasks, w._steals, w._busy_ns,
+                                  report._wall_ns == 0 ? 0.0 : static_cast<double> (w._busy_ns) / report._wall_ns});
+    }
+  return report;
+}
+
+// recursive matrix graph: each edge picks a quadrant of the adjacency matrix scale times with skewed
+// odds, which gives the power-law degrees and small diameter of real graphs
+std::vector<std::pair<uint32_t, uint32_t>>
+rmat_edges (uint32_t scale, uint64_t edge_factor, uint32_t seed)
+{
+  std::mt19937_64 rng (seed);
+  std::uniform_real_distribution<double> coin (0.0, 1.0);
+  std::vector<std::pair<uint32_t, uint32_t>> edges ((uint64_t{1} << scale) * edge_factor);
+  for (auto &[src, dst] : edges)
+    {
+      src = dst = 0;
+      for (uint32_t bit = 0; bit < scale; ++bit)
+        {
+          auto r = coin (rng);
+          // a = 0.57, b = 0.19, c = 0.19, d = 0.05: bottom half for c and d, right half for b and d
+          src |= static_cast<uint32_t> (r >= 0.76) << bit;
+          dst |= static_cast<uint32_t> ((r >= 0.57 && r < 0.76) || r >= 0.95) << bit;
+        }
+    }
+  return edges;
+}
+
+// csr of the edges, or of the reversed edges when transpose is set
+void
+build_csr (uint32_t n, std::vector<std::pair<uint32_t, uint32_t>> const &edges, bool transpose,
+           std::vector<uint64_t> &offsets, std::vector<uint32_t> &targets)
+{
+  offsets.assign (size_t{n} + 1, 0);
+  for (auto [src, dst] : edges)
+    {
+      ++offsets[(transpose ? dst : src) + 1];
+    }
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      offsets[v + 1] += offsets[v];
+    }
+  targets.resize (edges.size ());
+  auto fill = offsets;
+  for (auto [src, dst] : edges)
+    {
+      targets[fill[transpose ? dst : src]++] = transpose ? src : dst;
+    }
+}
+
+// plain queue bfs to check the engine against
+std::vector<uint32_t>
+reference_distances (csr_view const &out, uint32_t source)
+{
+  std::vector<uint32_t> distance (out.vertex_count (), unreached);
+  std::vector<uint32_t> queue{source};
+  distance[source] = 0;
+  for (size_t head = 0; head < queue.size (); ++head)
+    {
+      auto v = queue[head];
+      out.for_each_edge (v, [&] (uint32_t w) {
+        if (distance[w] == unreached)
+          {
+            distance[w] = distance[v] + 1;
+            queue.push_back (w);
+          }
+        return false;
+      });
+    }
+  return distance;
+}
+
+void
+bench_direction_optimizing_bfs (uint32_t scale)
+{
+  auto n = uint32_t{1} << scale;
+  auto edges = rmat_edges (scale, 16, 7);
+  std::vector<uint64_t> out_offsets, in_offsets;
+  std::vector<uint32_t> targets, sources;
+  build_csr (n, edges, false, out_offsets, targets);
+  build_csr (n, edges, true, in_offsets, sources);
+  csr_view out{n, out_offsets.data (), targets.data ()};
+  csr_view in{n, in_offsets.data (), sources.data ()};
+
+  // start from the biggest hub so the search actually covers the giant component
+  uint32_t source = 0;
+  for (uint32_t v = 0; v < n; ++v)
+    {
+      source = out.degree (v) > out.degree (source) ? v : source;
+    }
+
+  auto run = [&] (bfs_options const &options) {
+    auto start = std::chrono::high_resolution_clock::now ();
+    auto result = direction_optimizing_bfs (out, in, source, options);
+    auto end = std::chrono::high_resolution_clock::now ();
+    auto reached = std::count_if (result._distance.begin (), result._distance.end (),
+                                  [] (uint32_t d) { return d != unreached; });
+    auto us = std::chrono::duration_cast<std::chrono::microseconds> (end - start).count ();
+    std::cout << "  threads " << options._threads
+              << (options._direction_optimizing ? ", direction-optimizing: " : ", top-down only: ") << us
+              << "us, reached " << reached << '\n';
+  };
+
+  std::cout << "rmat bfs, scale " << scale << ", " << edges.size () << " edges\n";
+  bfs_options options;
+  options._threads = 1;
+  options._direction_optimizing = false;
+  run (options);
+  options._direction_optimizing = true;
+  run (options);
+  options._threads = std::max (1u, std::thread::hardware_concurrency ());
+  run (options);
+}
+
+template <typename Graph>
+std::vector<std::string>
+dfs_order (Graph const &graph)
+{
+  std::vector<std::string> order;
+  graph.for_each_dfs (on_discover ([&] (uint32_t v) {
+    order.push_back (graph.name (v));
     return false;
-  }
+  }));
+  return order;
+}
 
-  bool has_edge (std::string const &src, std::string const &dst) const
-  {
-    assert (!src.empty ());
-    assert (!dst.empty ());
-    auto src_it = _list.find (src);
-    if (src_it == _list.end ())
+template <typename Graph>
+std::vector<std::string>
+bfs_order (Graph const &graph)
+{
+  std::vector<std::string> order;
+  graph.for_each_bfs (on_discover ([&] (uint32_t v) {
+    order.push_back (graph.name (v));
+    return false;
+  }));
+  return order;
+}
+
+// a million tiny tasks in 1000 layers, every task waiting on two from the layer before
+void
+bench_task_graph ()
+{
+  uint32_t constexpr width = 1000;
+  uint32_t constexpr layers = 1000;
+  std::vector<std::pair<uint32_t, uint32_t>> edges;
+  std::mt19937 rng (3);
+  for (uint32_t layer = 0; layer + 1 < layers; ++layer)
+    {
+      for (uint32_t i = 0; i < width; ++i)
+        {
+          edges.emplace_back (layer * width + i, (layer + 1) * width + rng () % width);
+          edges.emplace_back (layer * width + i, (layer + 1) * width + rng () % width);
+        }
+    }
+  std::vector<uint64_t> offsets;
+  std::vector<uint32_t> targets;
+  build_csr (width * layers, edges, false, offsets, targets);
+  csr_view graph{width * layers, offsets.data (), targets.data ()};
+
+  std::vector<uint64_t> results (width * layers);
+  auto report = run_task_graph (graph, std::max (1u, std::thread::hardware_concurrency ()), [&] (uint32_t v, unsigned) {
+    uint64_t x = v;
+    for (int i = 0; i < 32; ++i)
       {
-        return false;
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
       }
-    auto &vec = src_it->second;
-    return std::find (vec.begin (), vec.end (), dst) != vec.end ();
-  }
+    results[v] = x;
+  });
 
-  bool empty () const { return _vertices.empty (); }
-};
+  std::cout << "task graph, " << width * layers << " tasks: " << report->_wall_ns / 1000 << "us, critical path "
+            << report->_critical_path_tasks << " tasks / " << report->_critical_path_ns / 1000 << "us\n";
+  for (size_t w = 0; w < report->_workers.size (); ++w)
+    {
+      auto const &stats = report->_workers[w];
+      std::cout << "  worker " << w << ": " << stats._tasks << " tasks, " << stats._steals << " steals, "
+                << static_cast<int> (stats._utilization * 100) << "% busy\n";
+    }
+}
+
+// side x side grid with edges both ways between neighbours, a cheap stand-in for a road network. weights
+// are between 1 and 10 so manhattan distance never overestimates
+void
+grid_graph (uint32_t side, uint32_t seed, std::vector<uint64_t> &offsets, std::vector<uint32_t> &targets,
+            std::vector<double> &weights)
+{
+  std::mt19937 rng (seed);
+  offsets.assign (1, 0);
+  targets.clear ();
+  weights.clear ();
+  for (uint32_t y = 0; y < side; ++y)
+    {
+      for (uint32_t x = 0; x < side; ++x)
+        {
+          auto link = [&] (uint32_t nx, uint32_t ny) {
+            targets.push_back (ny * side + nx);
+            weights.push_back (1.0 + rng () % 10);
+          };
+          if (x > 0)
+            link (x - 1, y);
+          if (x + 1 < side)
+            link (x + 1, y);
+          if (y > 0)
+            link (x, y - 1);
+          if (y + 1 < side)
+            link (x, y + 1);
+          offsets.push_back (targets.size ());
+        }
+    }
+}
+
+void
+bench_shortest_paths ()
+{
+  uint32_t constexpr side = 500;
+  size_t constexpr count = 20;
+  std::vector<uint64_t> offsets;
+  std::vector<uint32_t> targets;
+  std::vector<double> weights;
+  grid_graph (side, 9, offsets, targets, weights);
+  weighted_csr_view graph{csr_view{side * side, offsets.data (), targets.data ()}, weights.data ()};
+  path_search search (side * side);
+  std::mt19937 rng (21);
+  std::vector<std::pair<uint32_t, uint32_t>> queries (count);
+  for (auto &[from, to] : queries)
+    {
+      from = rng () % (side * side);
+      to = rng () % (side * side);
+    }
+
+  auto start = std::chrono::high_resolution_clock::now ();
+  search.run (graph, 0, unreached);
+  auto mid = std::chrono::high_resolution_clock::now ();
+  double dijkstra_total = 0.0;
+  for (auto [from, to] : queries)
+    {
+      dijkstra_total += *search.run (graph, from, to);
+    }
+  auto mid2 = std::chrono::high_resolution_clock::now ();
+  double astar_total = 0.0;
+  for (auto [from, to] : queries)
+    {
+      auto tx = static_cast<double> (to % side);
+      auto ty = static_cast<double> (to / side);
+      astar_total += *search.run (graph, from, to, [&] (uint32_t v) {
+        return std::abs (static_cast<double> (v % side) - tx) + std::abs (static_cast<double> (v / side) - ty);
+      });
+    }
+  auto end = std::chrono::high_resolution_clock::now ();
+  assert (dijkstra_total == astar_total);
+
+  auto us = [] (auto from, auto to) {
+    return static_cast<size_t> (std::chrono::duration_cast<std::chrono::microseconds> (to - from).count ());
+  };
+  std::cout << "shortest paths, " << side * side << " vertices, " << targets.size () << " edges: settle all "
+            << us (start, mid) << "us, point to point dijkstra " << us (mid, mid2) / count << "us, a* "
+            << us (mid2, end) / count << "us per query (total distance " << dijkstra_total << " / " << astar_total
+            << ")\n";
+}
 
 int
-main ()
+main (int argc, char **argv)
 {
   using namespace std::string_literals;
 
@@ -218,11 +925,8 @@ main ()
 
     assert (!graph.has_cycle ());
 
-    std::cout << "...Printing DFS... Should be: A B C D\n";
-    graph.dfs ();
-
-    std::cout << "...Printing BFS... Should be: A B C D\n";
-    graph.bfs ();
+    assert ((dfs_order (graph) == std::vector<std::string>{"A"s, "B"s, "C"s, "D"s}));
+    assert ((bfs_order (graph) == std::vector<std::string>{"A"s, "B"s, "C"s, "D"s}));
   }
 
   {
@@ -270,16 +974,58 @@ main ()
 
     assert (!graph.has_cycle ());
 
-    std::cout << "...Printing DFS... Should be: A B C D X F G\n";
-    graph.dfs ();
+    assert ((dfs_order (graph) == std::vector<std::string>{"A"s, "B"s, "C"s, "D"s, "X"s, "F"s, "G"s}));
+    assert ((bfs_order (graph) == std::vector<std::string>{"A"s, "B"s, "C"s, "X"s, "D"s, "F"s, "G"s}));
+
+    auto frozen = graph.freeze ();
+    assert (frozen.vertex_count () == 7);
+    assert (frozen.edge_count () == 5);
+    assert (frozen.has_edge (*frozen.id ("B"s), *frozen.id ("X"s)));
+    assert (!frozen.has_edge (*frozen.id ("X"s), *frozen.id ("B"s)));
+    assert (!frozen.id ("Z"s));
+    assert (!frozen.has_cycle ());
+
+    assert ((dfs_order (frozen) == std::vector<std::string>{"A"s, "B"s, "C"s, "D"s, "X"s, "F"s, "G"s}));
+    assert ((bfs_order (frozen) == std::vector<std::string>{"A"s, "B"s, "C"s, "X"s, "D"s, "F"s, "G"s}));
+
+    // Every hook at once: finish order is postorder, every edge gets looked at exactly once
+    struct recorder : graph_visitor
+    {
+      frozen_directed_graph const *_g;
+      std::vector<std::string> _finished;
+      size_t _edges{0};
+      uint32_t _stop_at{unreached};
+
+      bool discover (uint32_t v) { return v == _stop_at; }
+      bool edge (uint32_t, uint32_t) { return ++_edges, false; }
+      bool finish (uint32_t v) { return _finished.push_back (_g->name (v)), false; }
+    };
+    recorder all{{}, &frozen, {}, 0, unreached};
+    assert (!frozen.for_each_dfs (all));
+    assert ((all._finished == std::vector<std::string>{"D"s, "C"s, "X"s, "B"s, "A"s, "G"s, "F"s}));
+    assert (all._edges == 5);
+
+    // Early exit, and a single root
+    recorder stop{{}, &frozen, {}, 0, *frozen.id ("X"s)};
+    assert (frozen.for_each_dfs (stop));
+    assert ((stop._finished == std::vector<std::string>{"D"s, "C"s}));
+    std::vector<std::string> from_f;
+    frozen.for_each_bfs (on_discover ([&] (uint32_t v) { return from_f.push_back (frozen.name (v)), false; }),
+                         *frozen.id ("F"s));
+    assert ((from_f == std::vector<std::string>{"F"s, "G"s}));
 
-    std::cout << "...Printing DFS... Should be: A B C X D F G\n";
-    graph.bfs ();
+    auto tree = frozen.bfs_tree (*frozen.id ("A"s));
+    assert (tree._distance[*frozen.id ("A"s)] == 0);
+    assert (tree._distance[*frozen.id ("X"s)] == 2);
+    assert (tree._distance[*frozen.id ("D"s)] == 3);
+    assert (tree._parent[*frozen.id ("D"s)] == *frozen.id ("C"s));
+    assert (tree._distance[*frozen.id ("F"s)] == unreached);
 
     // Add a cycle
     graph.add_edge ("X"s, "A"s);
 
     assert (graph.has_cycle ());
+    assert (graph.freeze ().has_cycle ());
   }
 
   {
@@ -369,7 +1115,344 @@ main ()
     assert (!graph.has_cycle ());
   }
 
+  {
+    // Chains way too deep for a recursive traversal, mutable and frozen
+    sparse_directed_graph graph;
+    for (int i = 0; i < 200'000; ++i)
+      {
+        graph.add_vertex ("V" + std::to_string (i));
+      }
+    for (int i = 0; i < 199'999; ++i)
+      {
+        graph.add_edge ("V" + std::to_string (i), "V" + std::to_string (i + 1));
+      }
+    auto frozen = graph.freeze ();
+    assert (!frozen.has_cycle ());
+    assert (!graph.has_cycle ());
+    graph.add_edge ("V199999"s, "V0"s);
+    assert (graph.freeze ().has_cycle ());
+    assert (graph.find_cycle ().size () == 200'000);
+    assert (graph.condense ()._components == 1);
+    assert (!graph.topological_order ());
+    graph.remove_edge ("V199999"s, "V0"s);
+    assert (graph.topological_order ()->front () == 0);
+    assert (graph.condense ()._components == 200'000);
+    graph.add_edge ("V199999"s, "V0"s);
+    traversal_scratch scratch;
+    std::vector<uint32_t> cycle;
+    assert (graph.freeze ().find_cycle (scratch, cycle));
+    assert (cycle.size () == 200'000 && cycle.front () == 0 && cycle.back () == 199'999);
+  }
+
+  {
+    // Topological order puts every edge forward and gives up on cycles, on a tree-ish dag
+    sparse_directed_graph graph;
+    for (auto const &v : {"link"s, "compile"s, "headers"s, "test"s, "lint"s, "package"s})
+      {
+        graph.add_vertex (v);
+      }
+    graph.add_edge ("headers"s, "compile"s);
+    graph.add_edge ("compile"s, "link"s);
+    graph.add_edge ("link"s, "test"s);
+    graph.add_edge ("link"s, "package"s);
+    graph.add_edge ("test"s, "package"s);
+    auto order = graph.topological_order ();
+    assert (order && order->size () == 6);
+    std::vector<uint32_t> position (6);
+    for (uint32_t i = 0; i < 6; ++i)
+      {
+        position[(*order)[i]] = i;
+      }
+    for (auto const &[from, to] : {std::pair{"headers"s, "compile"s}, {"compile"s, "link"s}, {"link"s, "test"s},
+                                   {"link"s, "package"s}, {"test"s, "package"s}})
+      {
+        assert (position[*graph.id (from)] < position[*graph.id (to)]);
+      }
+    assert (graph.freeze ().topological_order ());
+    auto dag = graph.condense ();
+    assert (dag._components == 6 && dag._targets.size () == 5);
+    graph.add_edge ("package"s, "compile"s);
+    assert (!graph.topological_order ());
+    assert (!graph.freeze ().topological_order ());
+    graph.remove_vertex ("lint"s);
+    assert (!graph.topological_order ());
+  }
+
+  {
+    // Two cycles joined by one edge plus a loner condense to a three vertex dag in topological order
+    sparse_directed_graph graph;
+    for (auto const &v : {"A"s, "B"s, "C"s, "D"s, "E"s, "F"s})
+      {
+        graph.add_vertex (v);
+      }
+    graph.add_edge ("D"s, "E"s);
+    graph.add_edge ("E"s, "D"s);
+    graph.add_edge ("A"s, "B"s);
+    graph.add_edge ("B"s, "C"s);
+    graph.add_edge ("C"s, "A"s);
+    graph.add_edge ("C"s, "D"s);
+    graph.add_edge ("F"s, "F"s);
+    auto dag = graph.condense ();
+    auto component = [&] (std::string const &v) { return dag._component[*graph.id (v)]; };
+    assert (dag._components == 3);
+    assert (component ("A"s) == component ("B"s) && component ("B"s) == component ("C"s));
+    assert (component ("D"s) == component ("E"s));
+    assert (component ("A"s) < component ("D"s));
+    assert (dag._targets.size () == 1 && dag._targets[0] == component ("D"s));
+    std::vector<uint32_t> order;
+    assert (topological_order (dag.view (), order) && order.size () == 3);
+    graph.remove_vertex ("F"s);
+    assert (graph.condense ()._components == 2);
+    assert (graph.condense ()._component[5] == unreached);
+  }
+
+  {
+    // The reported cycle is the one closed by the back edge, not the path leading into it
+    sparse_directed_graph graph;
+    for (auto const &v : {"A"s, "B"s, "C"s, "D"s, "E"s})
+      {
+        graph.add_vertex (v);
+      }
+    graph.add_edge ("A"s, "B"s);
+    graph.add_edge ("B"s, "C"s);
+    graph.add_edge ("C"s, "D"s);
+    graph.add_edge ("D"s, "E"s);
+    graph.add_edge ("E"s, "C"s);
+    assert ((graph.find_cycle () == std::vector<std::string>{"C"s, "D"s, "E"s}));
+    graph.remove_vertex ("D"s);
+    assert (graph.find_cycle ().empty ());
+    assert (graph.freeze ().vertex_count () == 4);
+    graph.add_edge ("E"s, "E"s);
+    assert ((graph.find_cycle () == std::vector<std::string>{"E"s}));
+  }
+
+  {
+    // Self-loop and empty graph, frozen
+    sparse_directed_graph graph;
+    assert (!graph.freeze ().has_cycle ());
+    graph.add_vertex ("A"s);
+    graph.add_edge ("A"s, "A"s);
+    assert (graph.freeze ().has_cycle ());
+  }
+
+  {
+    // Direction-optimizing bfs agrees with a plain one on a skewed graph, in every mode
+    uint32_t constexpr scale = 12;
+    auto edges = rmat_edges (scale, 8, 1);
+    std::vector<uint64_t> out_offsets, in_offsets;
+    std::vector<uint32_t> targets, sources;
+    build_csr (1u << scale, edges, false, out_offsets, targets);
+    build_csr (1u << scale, edges, true, in_offsets, sources);
+    csr_view out{1u << scale, out_offsets.data (), targets.data ()};
+    csr_view in{1u << scale, in_offsets.data (), sources.data ()};
+    auto expected = reference_distances (out, 0);
+    for (unsigned threads : {1u, 4u})
+      {
+        for (bool direction_optimizing : {false, true})
+          {
+            bfs_options options;
+            options._threads = threads;
+            options._direction_optimizing = direction_optimizing;
+            auto result = direction_optimizing_bfs (out, in, 0, options);
+            assert (result._distance == expected);
+            for (uint32_t v = 1; v < out.vertex_count (); ++v)
+              {
+                auto p = result._parent[v];
+                assert ((p == unreached) == (expected[v] == unreached));
+                assert (p == unreached
+                        || (expected[p] + 1 == expected[v]
+                            && std::find (targets.data () + out_offsets[p], targets.data () + out_offsets[p + 1], v)
+                                   != targets.data () + out_offsets[p + 1]));
+              }
+          }
+      }
+  }
+
+  {
+    // Long thin graph: 300 parallel chains 500 long, so every level is wider than a chunk and the pool's
+    // workers are woken and parked again 500 times within one call
+    uint32_t constexpr width = 300, length = 500;
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    for (uint32_t i = 1; i <= width; ++i)
+      {
+        edges.emplace_back (0, i);
+      }
+    for (uint32_t v = 1; v + width <= width * length; ++v)
+      {
+        edges.emplace_back (v, v + width);
+      }
+    std::vector<uint64_t> out_offsets, in_offsets;
+    std::vector<uint32_t> targets, sources;
+    build_csr (width * length + 1, edges, false, out_offsets, targets);
+    build_csr (width * length + 1, edges, true, in_offsets, sources);
+    csr_view out{width * length + 1, out_offsets.data (), targets.data ()};
+    csr_view in{width * length + 1, in_offsets.data (), sources.data ()};
+    bfs_options options;
+    options._threads = 4;
+    auto result = direction_optimizing_bfs (out, in, 0, options);
+    assert (result._distance == reference_distances (out, 0));
+    assert (result._distance[width * length] == length);
+  }
+
+  {
+    // Diamond on the scheduler: every task once, and never before what it depends on
+    sparse_directed_graph graph;
+    for (auto const &v : {"A"s, "B"s, "C"s, "D"s})
+      {
+        graph.add_vertex (v);
+      }
+    graph.add_edge ("A"s, "B"s);
+    graph.add_edge ("A"s, "C"s);
+    graph.add_edge ("B"s, "D"s);
+    graph.add_edge ("C"s, "D"s);
+    auto frozen = graph.freeze ();
+    std::atomic<uint32_t> clock{0};
+    std::vector<uint32_t> stamp (4, unreached);
+    auto report = run_task_graph (frozen.view (), 4, [&] (uint32_t v, unsigned) { stamp[v] = clock++; });
+    assert (report && report->_critical_path_tasks == 3 && report->_workers.size () == 4);
+    assert (stamp[0] < stamp[1] && stamp[0] < stamp[2] && stamp[1] < stamp[3] && stamp[2] < stamp[3]);
+    uint64_t ran = 0;
+    for (auto const &w : report->_workers)
+      {
+        ran += w._tasks;
+      }
+    assert (ran == 4);
+    graph.add_edge ("D"s, "A"s);
+    assert (!run_task_graph (graph.freeze ().view (), 4, [] (uint32_t, unsigned) { assert (false); }));
+  }
+
+  {
+    // Random dag with a lot of fan-in, checked edge by edge after the run
+    uint32_t constexpr n = 20'000;
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    std::mt19937 rng (11);
+    for (uint32_t e = 0; e < 4 * n; ++e)
+      {
+        auto a = rng () % n;
+        auto b = rng () % n;
+        if (a != b)
+          {
+            edges.emplace_back (std::min (a, b), std::max (a, b));
+          }
+      }
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> targets;
+    build_csr (n, edges, false, offsets, targets);
+    csr_view dag{n, offsets.data (), targets.data ()};
+    std::atomic<uint32_t> clock{0};
+    std::vector<uint32_t> stamp (n, unreached);
+    std::vector<std::atomic<uint32_t>> runs (n);
+    for (auto &r : runs)
+      {
+        r.store (0);
+      }
+    auto report = run_task_graph (dag, 4, [&] (uint32_t v, unsigned) {
+      stamp[v] = clock++;
+      ++runs[v];
+    });
+    assert (report);
+    for (uint32_t v = 0; v < n; ++v)
+      {
+        assert (runs[v] == 1);
+      }
+    for (auto [a, b] : edges)
+      {
+        assert (stamp[a] < stamp[b]);
+      }
+  }
+
+  {
+    // Weighted edges: the cheap way round beats the direct edge, and removals keep weights lined up
+    sparse_directed_graph graph;
+    for (auto const &v : {"A"s, "B"s, "C"s, "D"s, "E"s})
+      {
+        graph.add_vertex (v);
+      }
+    graph.add_edge ("A"s, "B"s, 4.0);
+    graph.add_edge ("A"s, "C"s, 1.0);
+    graph.add_edge ("C"s, "B"s, 2.0);
+    graph.add_edge ("B"s, "D"s, 1.0);
+    graph.add_edge ("C"s, "D"s, 5.0);
+    auto frozen = graph.freeze ();
+    path_search search (frozen.vertex_count ());
+    auto id = [&] (std::string const &v) { return *frozen.id (v); };
+    assert (frozen.shortest_path (id ("A"s), id ("D"s), search) == 4.0);
+    assert ((search.path (id ("D"s)) == std::vector<uint32_t>{id ("A"s), id ("C"s), id ("B"s), id ("D"s)}));
+    assert (!frozen.shortest_path (id ("A"s), id ("E"s), search));
+    assert (search.path (id ("E"s)).empty ());
+    assert (frozen.shortest_path (id ("D"s), id ("D"s), search) == 0.0);
+    assert (!frozen.shortest_path (id ("D"s), id ("A"s), search)); // state from the last query doesn't leak
+
+    graph.remove_edge ("C"s, "B"s);
+    graph.remove_vertex ("E"s);
+    frozen = graph.freeze ();
+    assert (frozen.weight (id ("C"s), id ("D"s)) == 5.0 && frozen.weight (id ("A"s), id ("B"s)) == 4.0);
+    assert (frozen.shortest_path (id ("A"s), id ("D"s), search) == 5.0);
+  }
+
+  {
+    // Dijkstra against plain Bellman-Ford relaxation, and A* with an admissible heuristic against Dijkstra
+    uint32_t constexpr side = 40;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> targets;
+    std::vector<double> weights;
+    grid_graph (side, 4, offsets, targets, weights);
+    weighted_csr_view graph{csr_view{side * side, offsets.data (), targets.data ()}, weights.data ()};
+    path_search search (side * side);
+    search.run (graph, 0, unreached);
+
+    std::vector<double> expected (side * side, std::numeric_limits<double>::infinity ());
+    expected[0] = 0.0;
+    for (bool changed = true; changed;)
+      {
+        changed = false;
+        for (uint32_t v = 0; v < side * side; ++v)
+          {
+            for (auto e = offsets[v]; e < offsets[v + 1]; ++e)
+              {
+                if (expected[v] + weights[e] < expected[targets[e]])
+                  {
+                    expected[targets[e]] = expected[v] + weights[e];
+                    changed = true;
+                  }
+              }
+          }
+      }
+    for (uint32_t v = 0; v < side * side; ++v)
+      {
+        assert (search.distance (v) == expected[v]);
+      }
+
+    std::mt19937 rng (8);
+    for (int q = 0; q < 200; ++q)
+      {
+        auto from = static_cast<uint32_t> (rng () % (side * side));
+        auto to = static_cast<uint32_t> (rng () % (side * side));
+        auto dijkstra = search.run (graph, from, to);
+        auto astar = search.run (graph, from, to, [&] (uint32_t v) {
+          return std::abs (static_cast<double> (v % side) - to % side)
+                 + std::abs (static_cast<double> (v / side) - to / side);
+        });
+        assert (dijkstra && astar && *dijkstra == *astar);
+        double walked = 0.0;
+        auto path = search.path (to);
+        for (size_t i = 0; i + 1 < path.size (); ++i)
+          {
+            for (auto e = offsets[path[i]]; e < offsets[path[i] + 1]; ++e)
+              {
+                walked += targets[e] == path[i + 1] ? weights[e] : 0.0;
+              }
+          }
+        assert (path.front () == from && path.back () == to && walked == *astar);
+      }
+  }
+
   std::cout << "All tests passed!\n";
 
+  // ./sparse_directed_graph 22 for a ~67M edge run
+  bench_direction_optimizing_bfs (argc > 1 ? static_cast<uint32_t> (std::atoi (argv[1])) : 16);
+  bench_task_graph ();
+  bench_shortest_paths ();
+
   return EXIT_SUCCESS;
 }
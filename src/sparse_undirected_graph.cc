@@ -1,13 +1,23 @@
 #include <cassert>
 #include <iostream>
 #include <vector>
-#include <unordered_set>
 #include <unordered_map>
-#include <queue>
 #include <algorithm>
+#include <string>
+#include <optional>
+#include <cstdint>
+
+#include "graph_traversal.h"
 
 using namespace std::string_literals;
 
+//
+// vertex names are interned once: every vertex gets a dense uint32_t id and from there on adjacency,
+// visited sets and queues are all ids. an edge costs two 4-byte entries instead of two heap strings,
+// and removing a vertex only touches the lists of its own neighbours. ids of removed vertices go on a free
+// list and are handed out again, newest first, so the per-id vectors never outgrow the most vertices the
+// graph ever held at once. traversal goes by id, which is insertion order until a vertex is removed
+//
 class sparse_undirected_graph final
 {
 public:
@@ -18,13 +28,28 @@ public:
   {
     assert (!vertex.empty ());
 
-    if (_list.count (vertex) > 0)
+    if (_ids.count (vertex) > 0)
       {
         return false;
       }
 
-    _vertices.emplace_back (vertex);
-    _list.emplace (vertex, std::vector<std::string> ());
+    if (!_free_ids.empty ())
+      {
+        auto v = _free_ids.back ();
+        _free_ids.pop_back ();
+        _ids.emplace (vertex, v);
+        _names[v] = vertex;
+        _alive[v] = true;
+      }
+    else
+      {
+        _ids.emplace (vertex, static_cast<uint32_t> (_names.size ()));
+        _names.emplace_back (vertex);
+        _adjacency.emplace_back ();
+        _alive.push_back (true);
+      }
+
+    ++_vertex_count;
 
     return true;
   }
@@ -33,20 +58,30 @@ public:
   {
     assert (!vertex.empty ());
 
-    if (_list.find (vertex) == _list.end ())
+    auto it = _ids.find (vertex);
+
+    if (it == _ids.end ())
       {
         return false;
       }
 
-    _list.erase (vertex);
-
-    std::erase_if (_vertices, [&vertex] (std::string const &arg) { return arg == vertex; });
+    auto v = it->second;
 
-    for (auto &[_, neighbour] : _list)
+    for (auto neighbour : _adjacency[v])
       {
-        std::erase_if (neighbour, [&vertex] (std::string const &arg) { return arg == vertex; });
+        if (neighbour != v)
+          {
+            erase_id (_adjacency[neighbour], v);
+          }
       }
 
+    _ids.erase (it);
+    _adjacency[v] = std::vector<uint32_t> ();
+    _names[v] = std::string ();
+    _alive[v] = false;
+    _free_ids.push_back (v);
+    --_vertex_count;
+
     return true;
   }
 
@@ -55,18 +90,21 @@ public:
     assert (!src.empty ());
     assert (!dst.empty ());
 
-    if (_list.count (src) == 0 || _list.count (dst) == 0)
+    auto s = id (src);
+    auto d = id (dst);
+
+    if (!s || !d)
       {
         return false;
       }
 
-    if (std::find (_list[src].begin (), _list[src].end (), dst) != _list[src].end ())
+    if (std::find (_adjacency[*s].begin (), _adjacency[*s].end (), *d) != _adjacency[*s].end ())
       {
         return false;
       }
 
-    _list[src].emplace_back (dst);
-    _list[dst].emplace_back (src);
+    _adjacency[*s].emplace_back (*d);
+    _adjacency[*d].emplace_back (*s);
 
     return true;
   }
@@ -76,19 +114,22 @@ public:
     assert (!src.empty ());
     assert (!dst.empty ());
 
-    if (_list.count (src) == 0 || _list.count (dst) == 0)
+    auto s = id (src);
+    auto d = id (dst);
+
+    if (!s || !d)
       {
         return false;
       }
 
-    auto erased = std::erase_if (_list[src], [&dst] (std::string const &arg) { return arg == dst; });
+    auto erased = erase_id (_adjacency[*s], *d);
 
     if (erased == 0)
       {
         return false;
       }
 
-    std::erase_if (_list[dst], [&src] (std::string const &arg) { return arg == src; });
+    erase_id (_adjacency[*d], *s);
 
     return true;
   }
@@ -98,129 +139,128 @@ public:
     assert (!src.empty ());
     assert (!dst.empty ());
 
-    if (_list.count (src) == 0 || _list.count (dst) == 0)
+    auto s = id (src);
+    auto d = id (dst);
+
+    if (!s || !d)
       {
         return false;
       }
 
-    auto it = std::find (_list.at (src).begin (), _list.at (src).end (), dst);
-
-    return it != _list.at (src).end ();
+    return std::find (_adjacency[*s].begin (), _adjacency[*s].end (), *d) != _adjacency[*s].end ();
   }
 
-  bool empty () const { return _vertices.empty (); }
+  bool empty () const { return _vertex_count == 0; }
 
-  void dfs_helper (std::string const &vertex, std::unordered_set<std::string> &visited) const
+  std::optional<uint32_t> id (std::string const &vertex) const
   {
-    visited.emplace (vertex);
-
-    std::cout << vertex << ' ';
+    auto it = _ids.find (vertex);
 
-    for (auto const &edge : _list.at (vertex))
+    if (it == _ids.end ())
       {
-        if (visited.count (edge) == 0)
-          {
-            dfs_helper (edge, visited);
-          }
+        return std::nullopt;
       }
+
+    return it->second;
   }
 
-  void dfs () const
+  std::string const &name (uint32_t v) const { return _names[v]; }
+
+  // depth first over the ids with a graph_visitor (see graph_traversal.h), from every vertex or just root
+  template <typename Visitor> bool for_each_dfs (Visitor &&visitor, uint32_t root = unreached) const
   {
-    std::unordered_set<std::string> visited;
+    traversal_scratch scratch;
 
-    for (auto const &vertex : _vertices)
-      {
-        if (visited.count (vertex) == 0)
-          {
-            dfs_helper (vertex, visited);
-          }
-      }
+    return ::for_each_dfs (view (), scratch, visitor, root);
+  }
 
-    std::cout << '\n';
+  template <typename Visitor> bool for_each_bfs (Visitor &&visitor, uint32_t root = unreached) const
+  {
+    traversal_scratch scratch;
+
+    return ::for_each_bfs (view (), scratch, visitor, root);
   }
 
-  void bfs () const
+  // distance and parent of every id from source, the same view serves as both edge directions
+  bfs_result bfs_tree (std::string const &source, bfs_options const &options = {}) const
   {
-    std::queue<std::string> current_vertices;
-    std::unordered_set<std::string> visited;
+    auto it = _ids.find (source);
+    auto id = it == _ids.end () ? static_cast<uint32_t> (_names.size ()) : it->second;
 
-    for (auto const &vertex : _vertices)
-      {
-        if (visited.count (vertex) == 0)
-          {
-            visited.emplace (vertex);
-            current_vertices.emplace (vertex);
-
-            while (!current_vertices.empty ())
-              {
-                auto current = current_vertices.front ();
-
-                std::cout << current << ' ';
-
-                current_vertices.pop ();
-
-                for (auto const &edge : _list.at (current))
-                  {
-                    if (visited.count (edge) == 0)
-                      {
-                        current_vertices.emplace (edge);
-                        visited.emplace (edge);
-                      }
-                  }
-              }
-          }
-      }
+    return direction_optimizing_bfs (view (), view (), id, options);
+  }
+
+  // an edge to an already visited vertex that isn't the one we came from closes a cycle
+  bool has_cycle () const
+  {
+    traversal_scratch scratch;
+    std::vector<uint32_t> cycle;
 
-    std::cout << '\n';
+    return ::find_cycle<false> (view (), scratch, cycle);
   }
 
-  bool has_cycle_helper (std::string const &vertex, std::string const &parent,
-                         std::unordered_set<std::string> &visited) const
+  // the vertices of some cycle in walking order, empty if there's none
+  std::vector<std::string> find_cycle () const
   {
-    visited.emplace (vertex);
+    traversal_scratch scratch;
+    std::vector<uint32_t> cycle;
+    std::vector<std::string> names;
+
+    ::find_cycle<false> (view (), scratch, cycle);
 
-    for (auto const &edge : _list.at (vertex))
+    for (auto v : cycle)
       {
-        if (visited.count (edge) == 0)
-          {
-            if (has_cycle_helper (edge, vertex, visited))
-              {
-                return true;
-              }
-          }
-        else if (edge != parent)
-          {
-            return true;
-          }
+        names.push_back (_names[v]);
       }
 
-    return false;
+    return names;
   }
 
-  bool has_cycle () const
+private:
+  adjacency_list_view view () const { return adjacency_list_view{&_adjacency, &_alive}; }
+
+  static size_t erase_id (std::vector<uint32_t> &list, uint32_t id)
   {
-    std::unordered_set<std::string> visited;
+    auto it = std::remove (list.begin (), list.end (), id);
+    auto erased = static_cast<size_t> (list.end () - it);
 
-    for (auto const &vertex : _vertices)
-      {
-        if (visited.count (vertex) == 0)
-          {
-            if (has_cycle_helper (vertex, ""s, visited))
-              {
-                return true;
-              }
-          }
-      }
+    list.erase (it, list.end ());
 
-    return false;
+    return erased;
   }
 
-private:
-  std::vector<std::string> _vertices;
-  std::unordered_map<std::string, std::vector<std::string>> _list;
+  std::vector<std::string> _names; // id -> name, empty for removed vertices
+  std::unordered_map<std::string, uint32_t> _ids;
+  std::vector<std::vector<uint32_t>> _adjacency;
+  std::vector<bool> _alive;
+  std::vector<uint32_t> _free_ids; // removed ids, reused before new ones are made
+  size_t _vertex_count{0};
 };
 
+template <typename Graph>
+std::vector<std::string>
+dfs_order (Graph const &graph)
+{
+  std::vector<std::string> order;
+  graph.for_each_dfs (on_discover ([&] (uint32_t v) {
+    order.push_back (graph.name (v));
+    return false;
+  }));
+  return order;
+}
+
+template <typename Graph>
+std::vector<std::string>
+bfs_order (Graph const &graph)
+{
+  std::vector<std::string> order;
+  graph.for_each_bfs (on_discover ([&] (uint32_t v) {
+    order.push_back (graph.name (v));
+    return false;
+  }));
+  return order;
+}
+
 int
 main ()
 {
@@ -255,11 +295,8 @@ main ()
 
     assert (!graph.has_cycle ());
 
-    std::cout << "...Printing DFS... Should be: A B C D\n";
-    graph.dfs ();
-
-    std::cout << "...Printing BFS... Should be: A B C D\n";
-    graph.bfs ();
+    assert ((dfs_order (graph) == std::vector<std::string>{"A"s, "B"s, "C"s, "D"s}));
+    assert ((bfs_order (graph) == std::vector<std::string>{"A"s, "B"s, "C"s, "D"s}));
   }
 
   {
@@ -306,11 +343,8 @@ main ()
 
     assert (!graph.has_cycle ());
 
-    std::cout << "...Printing DFS... Should be: A B C D X F G\n";
-    graph.dfs ();
-
-    std::cout << "...Printing DFS... Should be: A B C X D F G\n";
-    graph.bfs ();
+    assert ((dfs_order (graph) == std::vector<std::string>{"A"s, "B"s, "C"s, "D"s, "X"s, "F"s, "G"s}));
+    assert ((bfs_order (graph) == std::vector<std::string>{"A"s, "B"s, "C"s, "X"s, "D"s, "F"s, "G"s}));
 
     // Add a cycle
     graph.add_edge ("X"s, "A"s);
@@ -358,6 +392,24 @@ main ()
     assert (!graph.has_edge ("A"s, "B"s));
     assert (!graph.has_edge ("B"s, "A"s));
     assert (!graph.has_cycle ());
+    assert (!graph.remove_vertex ("A"s));
+    assert (graph.add_vertex ("A"s)); // gets its old id back, with no edges
+    assert (!graph.has_edge ("A"s, "B"s));
+    assert (graph.add_edge ("A"s, "B"s));
+    assert (graph.has_edge ("B"s, "A"s));
+
+    // churn reuses ids instead of growing the id space, and a reused id starts out clean
+    auto a = *graph.id ("A"s);
+    for (int i = 0; i < 1'000; ++i)
+      {
+        assert (graph.remove_vertex ("A"s));
+        assert (graph.add_vertex ("A"s + std::to_string (i % 2)));
+        assert (graph.remove_vertex ("A"s + std::to_string (i % 2)));
+        assert (graph.add_vertex ("A"s));
+        assert (*graph.id ("A"s) == a);
+      }
+    assert (!graph.has_edge ("A"s, "B"s));
+    assert ((bfs_order (graph) == std::vector<std::string>{"A"s, "B"s}));
   }
 
   {
@@ -410,6 +462,46 @@ main ()
     assert (!graph.has_cycle ());
   }
 
+  {
+    // Removing a vertex in the middle splits the cycle and leaves the rest alone
+    sparse_undirected_graph graph;
+    for (auto const &v : {"A"s, "B"s, "C"s, "D"s})
+      {
+        graph.add_vertex (v);
+      }
+    graph.add_edge ("A"s, "B"s);
+    graph.add_edge ("B"s, "C"s);
+    graph.add_edge ("C"s, "A"s);
+    graph.add_edge ("C"s, "D"s);
+    assert (graph.has_cycle ());
+    assert ((graph.find_cycle () == std::vector<std::string>{"A"s, "B"s, "C"s}));
+    graph.remove_vertex ("B"s);
+    assert (!graph.has_cycle ());
+    assert (graph.find_cycle ().empty ());
+    assert (graph.has_edge ("A"s, "C"s) && graph.has_edge ("D"s, "C"s));
+    assert ((dfs_order (graph) == std::vector<std::string>{"A"s, "C"s, "D"s}));
+
+    auto tree = graph.bfs_tree ("A"s);
+    assert (tree._distance[*graph.id ("D"s)] == 2);
+    assert (tree._parent[*graph.id ("D"s)] == *graph.id ("C"s));
+    assert (tree._distance[*graph.id ("A"s)] == 0);
+    assert (graph.bfs_tree ("B"s)._distance == std::vector<uint32_t> (4, unreached));
+  }
+
+  {
+    // Deep chain, fine now that nothing recurses
+    sparse_undirected_graph graph;
+    for (int i = 0; i < 200'000; ++i)
+      {
+        graph.add_vertex ("V" + std::to_string (i));
+      }
+    for (int i = 0; i < 199'999; ++i)
+      {
+        graph.add_edge ("V" + std::to_string (i), "V" + std::to_string (i + 1));
+      }
+    assert (!graph.has_cycle ());
+  }
+
   std::cout << "All tests passed!\n";
 
   return EXIT_SUCCESS;
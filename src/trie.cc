@@ -4,44 +4,184 @@
 #include <vector>
 #include <string>
 #include <stack>
+#include <queue>
 #include <cstdint>
 #include <utility>
+#include <string_view>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <set>
+#include <limits>
+#include <immintrin.h>
+
+// bits.cc style helpers for the frozen layout
+static uint32_t
+get_bit (uint32_t n, uint32_t bitn)
+{
+  return (n & (1u << bitn)) != 0;
+}
 
-class trie final
+// how many bits are set below bitn, i.e. the rank of bitn among the set bits
+static uint32_t
+count_bits_below (uint32_t n, uint32_t bitn)
+{
+  return __builtin_popcount (n & ((1u << bitn) - 1));
+}
+
+//
+// read-only, compact form of a trie: every node is 8 bytes, a bitmap saying which letters have a child
+// (plus the finished flag in the top bit) and the index of its first child. nodes are laid out breadth
+// first so all children of a node sit next to each other, and the child for letter c is found at
+// first_child + (number of set bits below c). no pointers, no nulls, and siblings share cache lines
+//
+class frozen_trie final
 {
 public:
-  trie ()
-    : _root {nullptr}
-  {}
+  struct node final
+  {
+    uint32_t _mask;
+    uint32_t _first_child;
+  };
+
+  static uint32_t constexpr finished_bit {31};
 
-  ~trie ()
+  bool
+  contains_key (std::string const& key) const
   {
-    if (_root == nullptr)
+    if (key.empty () || empty ())
       {
-        return;
+        return false;
       }
 
-    std::stack<node*> nodes;
-    nodes.push (_root);
+    auto n = walk (key);
 
-    while (! nodes.empty ())
+    return n != npos && get_bit (_nodes[n]._mask, finished_bit);
+  }
+
+  bool
+  contains_prefix (std::string const& prefix) const
+  {
+    if (prefix.empty () || empty ())
       {
-        auto c = nodes.top ();
+        return false;
+      }
 
-        nodes.pop ();
+    return walk (prefix) != npos;
+  }
 
-        for (auto* p : c->_children)
+  bool
+  empty () const
+  {
+    return _nodes.empty () || (_nodes[0]._mask & ~(1u << finished_bit)) == 0;
+  }
+
+  std::vector<std::string>
+  get_words_with_shared_prefix (std::string const& prefix) const
+  {
+    std::vector<std::string> words;
+
+    if (prefix.empty () || empty ())
+      {
+        return words;
+      }
+
+    auto n = walk (prefix);
+
+    if (n == npos)
+      {
+        return words;
+      }
+
+    // same order and semantics as trie::get_words_with_shared_prefix
+    std::stack<std::pair<uint32_t, std::string>> current;
+    current.emplace (n, prefix);
+
+    while (! current.empty ())
+      {
+        auto [n, str] = current.top ();
+
+        current.pop ();
+
+        auto const& nd = _nodes[n];
+
+        if (get_bit (nd._mask, finished_bit))
           {
-            if (p != nullptr)
+            words.emplace_back (str);
+          }
+        else
+          {
+            auto child = nd._first_child;
+
+            for (uint32_t i = 0; i < alphabet_size; ++i)
               {
-                nodes.push (p);
+                if (get_bit (nd._mask, i))
+                  {
+                    current.emplace (child++, str + static_cast<char> ('a' + i));
+                  }
               }
           }
+      }
 
-        delete c;
+    return words;
+  }
+
+  size_t
+  memory_usage () const
+  {
+    return _nodes.capacity () * sizeof (node);
+  }
+
+private:
+  friend class trie;
+
+  static uint32_t constexpr alphabet_size {26};
+  static uint32_t constexpr npos {~0u};
+
+  explicit frozen_trie (std::vector<node>&& nodes)
+    : _nodes {std::move (nodes)}
+  {}
+
+  uint32_t
+  walk (std::string const& key) const
+  {
+    uint32_t n {0};
+
+    for (auto const& l : key)
+      {
+        uint32_t child = static_cast<unsigned char> (l) - 'a';
+
+        if (child >= alphabet_size || ! get_bit (_nodes[n]._mask, child))
+          {
+            return npos;
+          }
+
+        n = _nodes[n]._first_child + count_bits_below (_nodes[n]._mask, child);
       }
+
+    return n;
   }
 
+  std::vector<node> _nodes;
+};
+
+//
+// nodes live in one vector and point at each other with 32-bit indices (0 is "no child", the root is
+// always node 0 and never anybody's child). half the size of a pointer per child, nodes sit next to each
+// other in memory, and tearing the whole thing down is a single free. removed nodes go on a free list
+//
+class trie final
+{
+public:
+  trie ()
+    : _nodes (1, node (false))
+  {}
+
   void
   insert (std::string const& key)
   {
@@ -50,27 +190,23 @@ public:
         return;
       }
 
-    if (_root == nullptr)
-      {
-        _root = new node (false);
-      }
-
-    node* current_node {_root};
+    uint32_t current_node {root};
     uint32_t child;
 
     for (auto const& n : key)
       {
         child = n - 'a';
 
-        if (current_node->_children[child] == nullptr)
+        if (_nodes[current_node]._children[child] == null)
           {
-            current_node->_children[child] = new node (false);
+            auto fresh = new_node (); // may grow _nodes, don't hold references across it
+            _nodes[current_node]._children[child] = fresh;
           }
 
-        current_node = current_node->_children[child];
+        current_node = _nodes[current_node]._children[child];
       }
 
-    current_node->_finished = true;
+    _nodes[current_node]._finished = true;
   }
 
   bool
@@ -81,46 +217,46 @@ public:
         return false;
       }
 
-    std::stack<node*> nodes;
-    nodes.push (_root);
+    std::stack<uint32_t> nodes;
+    nodes.push (root);
     uint32_t child;
 
     for (auto const& n : key)
       {
-        auto* current_node = nodes.top ();
+        auto current_node = nodes.top ();
 
         child = n - 'a';
 
-        if (current_node->_children[child] == nullptr)
+        if (_nodes[current_node]._children[child] == null)
           {
             return false;
           }
 
-        nodes.push (current_node->_children[child]);
+        nodes.push (_nodes[current_node]._children[child]);
       }
 
-    if (! nodes.top ()->_finished)
+    if (! _nodes[nodes.top ()]._finished)
       {
         return false;
       }
 
     if (! is_leaf (nodes.top ()))
       {
-        nodes.top ()->_finished = false;
+        _nodes[nodes.top ()]._finished = false;
         return true;
       }
 
     while (! nodes.empty () && is_leaf (nodes.top ()))
       {
-        auto* child = nodes.top ();
+        auto child = nodes.top ();
 
         nodes.pop ();
 
         if (! nodes.empty ())
           {
-            auto* parent = nodes.top ();
-            parent->_children[key[nodes.size () - 1] - 'a'] = nullptr;
-            delete child;
+            auto parent = nodes.top ();
+            _nodes[parent]._children[key[nodes.size () - 1] - 'a'] = null;
+            free_node (child);
           }
       }
 
@@ -135,22 +271,22 @@ public:
         return false;
       }
 
-    auto* current_node = _root;
+    uint32_t current_node {root};
     uint32_t child;
 
     for (auto const& n : key)
       {
         child = n - 'a';
 
-        if (current_node->_children[child] == nullptr)
+        if (_nodes[current_node]._children[child] == null)
           {
             return false;
           }
 
-        current_node = current_node->_children[child];
+        current_node = _nodes[current_node]._children[child];
       }
 
-    return current_node->_finished;
+    return _nodes[current_node]._finished;
   }
 
   bool
@@ -161,19 +297,19 @@ public:
         return false;
       }
 
-    auto* current_node = _root;
+    uint32_t current_node {root};
     uint32_t child;
 
     for (auto const& n : prefix)
       {
         child = n - 'a';
 
-        if (current_node->_children[child] == nullptr)
+        if (_nodes[current_node]._children[child] == null)
           {
             return false;
           }
 
-        current_node = current_node->_children[child];
+        current_node = _nodes[current_node]._children[child];
       }
 
     return true;
@@ -182,7 +318,7 @@ public:
   bool
   empty () const
   {
-    return is_leaf (_root);
+    return is_leaf (root);
   }
 
   std::vector<std::string>
@@ -195,22 +331,22 @@ public:
         return words;
       }
 
-    auto* n = _root;
+    uint32_t n {root};
     uint32_t child;
 
     for (auto const& l : prefix)
       {
         child = l - 'a';
 
-        if (n->_children[child] == nullptr)
+        if (_nodes[n]._children[child] == null)
           {
             return words;
           }
 
-        n = n->_children[child];
+        n = _nodes[n]._children[child];
       }
 
-    std::stack<std::pair<node*, std::string>> current;
+    std::stack<std::pair<uint32_t, std::string>> current;
     current.emplace (std::make_pair (n, prefix));
 
     while (! current.empty ())
@@ -219,55 +355,296 @@ public:
 
         current.pop ();
 
-        if (n->_finished)
+        if (_nodes[n]._finished)
           {
             words.emplace_back (str);
           }
         else
           {
-            for (uint32_t i = 0; i < n->_children.size (); ++i)
-	      {
-		if (n->_children[i] != nullptr)
-		  {
-		    char letter = static_cast<char>('a' + i);
-		    current.emplace (std::make_pair (n->_children[i], str + letter));
-		  }
-	      }
+            for (uint32_t i = 0; i < alphabet_size; ++i)
+              {
+                if (_nodes[n]._children[i] != null)
+                  {
+                    char letter = static_cast<char>('a' + i);
+                    current.emplace (std::make_pair (_nodes[n]._children[i], str + letter));
+                  }
+              }
+          }
+      }
+
+    return words;
+  }
+
+  // scratch space for for_each_word_with_prefix. hang on to one and pass it in every time and the
+  // enumeration stops allocating once it has seen the longest word
+  struct walk_scratch final
+  {
+    std::string _key;
+    std::vector<uint32_t> _path;
+  };
+
+  // calls visit (std::string_view word) for every word starting with prefix, in lexicographic order,
+  // including words that extend other words ("app" and "apple"). the view is only good until visit
+  // returns, the same buffer gets reused for the next word. return false from visit to stop early
+  template <typename Visitor>
+  void
+  for_each_word_with_prefix (std::string_view prefix, Visitor&& visit, walk_scratch& scratch) const
+  {
+    uint32_t n {root};
+
+    for (auto const& l : prefix)
+      {
+        uint32_t child = static_cast<unsigned char> (l) - 'a';
+
+        if (child >= alphabet_size || _nodes[n]._children[child] == null)
+          {
+            return;
+          }
+
+        n = _nodes[n]._children[child];
+      }
+
+    auto& key = scratch._key;
+    auto& path = scratch._path;
+    key.assign (prefix);
+    path.clear ();
+    path.push_back (n);
+
+    if (n != root && _nodes[n]._finished && ! visit (std::string_view (key)))
+      {
+        return;
+      }
+
+    // preorder, children a to z: a word always comes before its extensions, which is lexicographic order
+    uint32_t letter {0};
+
+    while (true)
+      {
+        auto const& current = _nodes[path.back ()];
+
+        for (; letter < alphabet_size && current._children[letter] == null; ++letter)
+          ;
+
+        if (letter < alphabet_size)
+          {
+            auto child = current._children[letter];
+            key.push_back (static_cast<char> ('a' + letter));
+            path.push_back (child);
+
+            if (_nodes[child]._finished && ! visit (std::string_view (key)))
+              {
+                return;
+              }
+
+            letter = 0;
+            continue;
+          }
+
+        path.pop_back ();
+
+        if (path.empty ())
+          {
+            return;
           }
+
+        letter = key.back () - 'a' + 1;
+        key.pop_back ();
+      }
+  }
+
+  template <typename Visitor>
+  void
+  for_each_word_with_prefix (std::string_view prefix, Visitor&& visit) const
+  {
+    walk_scratch scratch;
+    for_each_word_with_prefix (prefix, std::forward<Visitor> (visit), scratch);
+  }
+
+  // first `limit` completions of prefix in lexicographic order, stops walking as soon as it has them
+  std::vector<std::string>
+  get_first_words_with_prefix (std::string_view prefix, size_t limit) const
+  {
+    std::vector<std::string> words;
+
+    if (limit == 0)
+      {
+        return words;
       }
 
+    for_each_word_with_prefix (prefix, [&words, limit] (std::string_view word) {
+      words.emplace_back (word);
+      return words.size () < limit;
+    });
+
     return words;
   }
 
+  // out[i] = contains_key (keys[i]). a single lookup is a chain of dependent loads, so instead of
+  // walking the keys one after the other this keeps `lanes` walks in flight and advances them round robin
+  // (amac style), prefetching the exact child slot each one reads next. while one lane waits on memory
+  // the others make progress, and a finished lane picks up the next key straight away
+  void
+  contains_keys (std::string_view const* keys, size_t n, std::vector<bool>& out) const
+  {
+    static uint32_t constexpr lanes {16};
+
+    struct lane final
+    {
+      size_t _key;
+      uint32_t _depth;
+      uint32_t _node;
+    };
+
+    out.assign (n, false);
+    lane in_flight[lanes];
+    uint32_t active {0};
+    size_t next {0};
+
+    auto start = [&] (lane& l) {
+      // empty keys are never in there, don't even give them a lane
+      for (; next < n && keys[next].empty (); ++next)
+        ;
+
+      if (next == n)
+        {
+          return false;
+        }
+
+      l = {next++, 0, root};
+      auto first = (uint32_t {static_cast<unsigned char> (keys[l._key][0])} - 'a') % alphabet_size;
+      __builtin_prefetch (&_nodes[root]._children[first]);
+
+      return true;
+    };
+
+    for (; active < lanes && start (in_flight[active]); ++active)
+      ;
+
+    while (active > 0)
+      {
+        for (uint32_t i = 0; i < active;)
+          {
+            auto& l = in_flight[i];
+            auto const& key = keys[l._key];
+            uint32_t child = static_cast<unsigned char> (key[l._depth]) - 'a';
+            bool done {true};
+
+            if (child < alphabet_size && _nodes[l._node]._children[child] != null)
+              {
+                l._node = _nodes[l._node]._children[child];
+
+                if (++l._depth == key.size ())
+                  {
+                    out[l._key] = _nodes[l._node]._finished;
+                  }
+                else
+                  {
+                    auto next_child = (uint32_t {static_cast<unsigned char> (key[l._depth])} - 'a') % alphabet_size;
+                    __builtin_prefetch (&_nodes[l._node]._children[next_child]);
+                    done = false;
+                  }
+              }
+
+            if (! done)
+              {
+                ++i;
+              }
+            else if (! start (l))
+              {
+                l = in_flight[--active]; // no keys left to refill with, close the gap
+              }
+          }
+      }
+  }
+
+  // compact copy for after the bulk load is done, see frozen_trie
+  frozen_trie
+  freeze () const
+  {
+    std::vector<frozen_trie::node> nodes;
+
+    // breadth first: by the time a node is numbered, its children get the next free run of indices
+    std::queue<uint32_t> pending;
+    pending.push (root);
+    nodes.push_back ({0, 0});
+    uint32_t next {1};
+
+    for (uint32_t index = 0; ! pending.empty (); ++index)
+      {
+        auto const& n = _nodes[pending.front ()];
+
+        pending.pop ();
+
+        uint32_t mask = n._finished ? 1u << frozen_trie::finished_bit : 0;
+
+        for (uint32_t i = 0; i < alphabet_size; ++i)
+          {
+            if (n._children[i] != null)
+              {
+                mask |= 1u << i;
+                pending.push (n._children[i]);
+                nodes.push_back ({0, 0});
+              }
+          }
+
+        nodes[index] = {mask, next};
+        next += __builtin_popcount (mask & ((1u << alphabet_size) - 1));
+      }
+
+    return frozen_trie (std::move (nodes));
+  }
+
+  size_t
+  memory_usage () const
+  {
+    return _nodes.capacity () * sizeof (node) + _free.capacity () * sizeof (uint32_t);
+  }
+
 private:
   static uint32_t constexpr alphabet_size {26};
+  static uint32_t constexpr root {0};
+  static uint32_t constexpr null {0};
 
   struct node final
   {
     node (bool finished)
       : _finished {finished}
     {
-      for (auto*& p : _children)
-        {
-          p = nullptr;
-        }
+      _children.fill (null);
     }
 
     bool _finished;
-    std::array<node*, alphabet_size> _children;
+    std::array<uint32_t, alphabet_size> _children;
   };
 
-  bool
-  is_leaf (node* current) const
+  uint32_t
+  new_node ()
   {
-    if (current == nullptr)
+    if (! _free.empty ())
       {
-        return true;
+        auto n = _free.back ();
+        _free.pop_back ();
+        return n;
       }
 
-    for (auto* p : current->_children)
+    _nodes.emplace_back (false);
+
+    return static_cast<uint32_t> (_nodes.size () - 1);
+  }
+
+  void
+  free_node (uint32_t n)
+  {
+    _nodes[n] = node (false);
+    _free.push_back (n);
+  }
+
+  bool
+  is_leaf (uint32_t current) const
+  {
+    for (auto p : _nodes[current]._children)
       {
-        if (p != nullptr)
+        if (p != null)
           {
             return false;
           }
@@ -276,49 +653,1496 @@ private:
     return true;
   }
 
-  node* _root;
+  std::vector<node> _nodes;
+  std::vector<uint32_t> _free;
 };
 
-int
-main ()
+//
+// path compressed (patricia) trie over arbitrary bytes. chains of single-child nodes collapse into one
+// edge label, so a lookup touches one node per branching point instead of one per character, and any
+// byte works as a key character (uppercase, digits, '/', utf-8, ...). same storage idea as trie: nodes
+// sit in one vector and point at each other with 32-bit indices, labels are (offset, length) into one
+// shared byte buffer, and each node's children are one block in a shared pool, the sorted first bytes of
+// their labels (finding a child is one sse compare per 16 children) followed by their node indices.
+// splitting an edge only moves an offset, no bytes are copied
+//
+class radix_trie final
 {
-  using namespace std::string_literals;
+public:
+  radix_trie ()
+    : _nodes (1)
+  {}
 
-  trie t;
+  void
+  insert (std::string_view key)
+  {
+    if (key.empty ())
+      {
+        return;
+      }
 
-  // Test inserting and searching for single characters
-  t.insert ("a"s);
-  t.insert ("b"s);
-  assert (t.contains_key ("a"s));
-  assert (t.contains_key ("b"s));
-  assert (! t.contains_key ("c"s));
+    auto n = root;
 
-  // Test inserting and searching for overlapping words
-  t.insert ("apple"s);
-  t.insert ("app"s);
-  assert (t.contains_key ("apple"s));
-  assert (t.contains_key ("app"s));
-  assert (t.contains_prefix ("ap"s));
-  assert (!t.contains_key ("ap"s));
+    while (! key.empty ())
+      {
+        auto slot = find_child (n, key[0]);
 
-  // Test removing non-existent words
-  t.remove ("banana"s); // Should not affect the trie
-  assert (t.contains_key ("apple"s));
-  assert (t.contains_key ("app"s));
+        if (slot == npos)
+          {
+            add_child (n, new_node (key, true));
+            return;
+          }
 
-  // Test removing words with shared prefixes
-  t.remove ("app"s);
-  assert (! t.contains_key ("app"s));
-  assert (t.contains_key ("apple"s)); // "apple" should still exist
+        auto child = children (n)[slot];
+        auto common = common_prefix (label (child), key);
 
-  // Test edge cases
-  t.insert (""s); // Insert empty string
-  assert (! t.contains_key (""s)); // Should not be found
+        if (common < _nodes[child]._label_length)
+          {
+            // key leaves (or ends) in the middle of the edge: split it at the divergence point, the new
+            // middle node takes the front of child's label and child keeps the rest of the same bytes
+            auto middle = new_node (_nodes[child]._label, static_cast<uint32_t> (common), false);
+            _nodes[child]._label += static_cast<uint32_t> (common);
+            _nodes[child]._label_length -= static_cast<uint32_t> (common);
+            add_child (middle, child);
+            children (n)[slot] = middle;
+            child = middle;
+          }
 
-  t.insert ("test"s);
-  t.remove ("test"s);
-  t.remove ("test"s); // Remove twice
-  assert(! t.contains_key("test"s));
+        key.remove_prefix (common);
+        n = child;
+      }
+
+    _nodes[n]._finished = true;
+  }
+
+  bool
+  remove (std::string_view key)
+  {
+    if (key.empty ())
+      {
+        return false;
+      }
+
+    auto parent = null;
+    auto n = root;
+
+    while (! key.empty ())
+      {
+        auto slot = find_child (n, key[0]);
+
+        if (slot == npos)
+          {
+            return false;
+          }
+
+        auto child = children (n)[slot];
+
+        if (! starts_with (key, label (child)))
+          {
+            return false;
+          }
+
+        key.remove_prefix (_nodes[child]._label_length);
+        parent = n;
+        n = child;
+      }
+
+    if (! _nodes[n]._finished)
+      {
+        return false;
+      }
+
+    _nodes[n]._finished = false;
+
+    if (_nodes[n]._child_count == 0)
+      {
+        remove_child (parent, find_child (parent, label (n)[0]));
+        free_node (n);
+        // the parent may now be a pass-through node, fold it into its last child
+        merge_with_child (parent);
+      }
+    else
+      {
+        merge_with_child (n);
+      }
+
+    // merges append relabelled edges, once most of the buffer is dead bytes it's rewritten
+    if (_labels.size () > 2 * _live_label_bytes + 4096)
+      {
+        compact_labels ();
+      }
+
+    return true;
+  }
+
+  bool
+  contains_key (std::string_view key) const
+  {
+    if (key.empty ())
+      {
+        return false;
+      }
+
+    size_t edge_rest {0};
+    auto n = walk (key, edge_rest);
+
+    return n != null && edge_rest == 0 && _nodes[n]._finished;
+  }
+
+  bool
+  contains_prefix (std::string_view prefix) const
+  {
+    if (prefix.empty () || empty ())
+      {
+        return false;
+      }
+
+    size_t edge_rest {0};
+
+    return walk (prefix, edge_rest) != null;
+  }
+
+  bool
+  empty () const
+  {
+    return _nodes[root]._child_count == 0;
+  }
+
+  // every stored key starting with prefix, in lexicographic order
+  std::vector<std::string>
+  get_words_with_shared_prefix (std::string_view prefix) const
+  {
+    std::vector<std::string> words;
+
+    if (prefix.empty ())
+      {
+        return words;
+      }
+
+    size_t edge_rest {0};
+    auto n = walk (prefix, edge_rest);
+
+    if (n == null)
+      {
+        return words;
+      }
+
+    // the prefix may stop part way into n's label, the rest of the label still belongs to every word
+    std::string word (prefix);
+    word += label (n).substr (_nodes[n]._label_length - edge_rest);
+    collect (n, word, words);
+
+    return words;
+  }
+
+private:
+  static size_t constexpr npos {~size_t {0}};
+  static uint32_t constexpr root {0};
+  static uint32_t constexpr null {0}; // the root is nobody's child
+  static uint32_t constexpr max_children {256};
+
+  struct node final
+  {
+    uint32_t _label {0};        // edge label leading into this node, offset into _labels
+    uint32_t _label_length {0};
+    uint32_t _children {0};     // block offset into _blocks
+    uint16_t _child_count {0};
+    uint16_t _child_capacity {0}; // 0 or a power of 2, the size of the block
+    bool _finished {false};
+  };
+
+  std::string_view
+  label (uint32_t n) const
+  {
+    return std::string_view (_labels.data () + _nodes[n]._label, _nodes[n]._label_length);
+  }
+
+  static size_t
+  common_prefix (std::string_view a, std::string_view b)
+  {
+    size_t i {0};
+
+    for (auto n = std::min (a.size (), b.size ()); i < n && a[i] == b[i]; ++i)
+      ;
+
+    return i;
+  }
+
+  static bool
+  starts_with (std::string_view s, std::string_view prefix)
+  {
+    return s.substr (0, prefix.size ()) == prefix;
+  }
+
+  // a block for capacity children is the first bytes (in whole 16 byte chunks) followed by the node indices,
+  // so the compare and the index it picks share cache lines
+  static uint32_t
+  byte_words (uint32_t capacity)
+  {
+    return std::max (4u, (capacity + 15) / 16 * 4);
+  }
+
+  char*
+  first_bytes (uint32_t n)
+  {
+    return reinterpret_cast<char*> (_blocks.data () + _nodes[n]._children);
+  }
+
+  char const*
+  first_bytes (uint32_t n) const
+  {
+    return reinterpret_cast<char const*> (_blocks.data () + _nodes[n]._children);
+  }
+
+  uint32_t*
+  children (uint32_t n)
+  {
+    return _blocks.data () + _nodes[n]._children + byte_words (_nodes[n]._child_capacity);
+  }
+
+  uint32_t const*
+  children (uint32_t n) const
+  {
+    return _blocks.data () + _nodes[n]._children + byte_words (_nodes[n]._child_capacity);
+  }
+
+  // log2 of a block size, the index into _free_blocks
+  static uint32_t
+  size_class (uint32_t capacity)
+  {
+    return static_cast<uint32_t> (__builtin_ctz (capacity));
+  }
+
+  uint32_t
+  new_node (uint32_t label, uint32_t label_length, bool finished)
+  {
+    node n;
+    n._label = label;
+    n._label_length = label_length;
+    n._finished = finished;
+
+    if (! _free_nodes.empty ())
+      {
+        auto i = _free_nodes.back ();
+        _free_nodes.pop_back ();
+        _nodes[i] = n;
+        return i;
+      }
+
+    _nodes.push_back (n);
+
+    return static_cast<uint32_t> (_nodes.size () - 1);
+  }
+
+  // a node whose label is a fresh copy of bytes
+  uint32_t
+  new_node (std::string_view bytes, bool finished)
+  {
+    assert (_labels.size () + bytes.size () <= std::numeric_limits<uint32_t>::max ());
+    auto offset = static_cast<uint32_t> (_labels.size ());
+    _labels.append (bytes);
+    _live_label_bytes += bytes.size ();
+
+    return new_node (offset, static_cast<uint32_t> (bytes.size ()), finished);
+  }
+
+  void
+  free_node (uint32_t n)
+  {
+    release_block (n);
+    _live_label_bytes -= _nodes[n]._label_length;
+    _nodes[n] = node ();
+    _free_nodes.push_back (n);
+  }
+
+  uint32_t
+  allocate_block (uint32_t capacity)
+  {
+    auto& free = _free_blocks[size_class (capacity)];
+
+    if (! free.empty ())
+      {
+        auto offset = free.back ();
+        free.pop_back ();
+        return offset;
+      }
+
+    auto offset = static_cast<uint32_t> (_blocks.size ());
+    _blocks.resize (offset + byte_words (capacity) + capacity);
+
+    return offset;
+  }
+
+  void
+  release_block (uint32_t n)
+  {
+    if (_nodes[n]._child_capacity != 0)
+      {
+        _free_blocks[size_class (_nodes[n]._child_capacity)].push_back (_nodes[n]._children);
+      }
+
+    _nodes[n]._children = 0;
+    _nodes[n]._child_count = 0;
+    _nodes[n]._child_capacity = 0;
+  }
+
+  size_t
+  find_child (uint32_t n, char c) const
+  {
+    // 16 first bytes per compare, what's past the children is masked off (the bytes part of a block is a
+    // multiple of 16 so the load never leaves it)
+    uint32_t count = _nodes[n]._child_count;
+    auto const* bytes = first_bytes (n);
+    auto needle = _mm_set1_epi8 (c);
+
+    for (uint32_t i = 0; i < count; i += 16)
+      {
+        auto chunk = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (bytes + i));
+        auto bits = static_cast<uint32_t> (_mm_movemask_epi8 (_mm_cmpeq_epi8 (chunk, needle)));
+
+        if (count - i < 16)
+          {
+            bits &= (1u << (count - i)) - 1;
+          }
+
+        if (bits != 0)
+          {
+            return i + __builtin_ctz (bits);
+          }
+      }
+
+    return npos;
+  }
+
+  void
+  add_child (uint32_t n, uint32_t child)
+  {
+    auto count = _nodes[n]._child_count;
+
+    if (count == _nodes[n]._child_capacity)
+      {
+        // full block: move to one twice the size and give the old one back
+        auto capacity = std::max (1u, 2u * count);
+        assert (capacity <= max_children);
+        auto block = allocate_block (capacity);
+        auto* bytes = reinterpret_cast<char*> (_blocks.data () + block);
+        auto* ids = _blocks.data () + block + byte_words (capacity);
+        std::copy_n (first_bytes (n), count, bytes);
+        std::copy_n (children (n), count, ids);
+        release_block (n);
+        _nodes[n]._children = block;
+        _nodes[n]._child_count = count;
+        _nodes[n]._child_capacity = static_cast<uint16_t> (capacity);
+      }
+
+    auto* bytes = first_bytes (n);
+    auto* ids = children (n);
+    auto first = label (child)[0];
+    uint32_t i {0};
+
+    for (; i < count && static_cast<unsigned char> (bytes[i]) < static_cast<unsigned char> (first); ++i)
+      ;
+
+    std::copy_backward (bytes + i, bytes + count, bytes + count + 1);
+    std::copy_backward (ids + i, ids + count, ids + count + 1);
+    bytes[i] = first;
+    ids[i] = child;
+    ++_nodes[n]._child_count;
+  }
+
+  void
+  remove_child (uint32_t n, size_t slot)
+  {
+    auto* bytes = first_bytes (n);
+    auto* ids = children (n);
+    auto count = _nodes[n]._child_count;
+    std::copy (bytes + slot + 1, bytes + count, bytes + slot);
+    std::copy (ids + slot + 1, ids + count, ids + slot);
+
+    if (--_nodes[n]._child_count == 0)
+      {
+        release_block (n);
+      }
+  }
+
+  void
+  merge_with_child (uint32_t n)
+  {
+    if (n == root || _nodes[n]._finished || _nodes[n]._child_count != 1)
+      {
+        return;
+      }
+
+    auto child = children (n)[0];
+
+    if (_nodes[n]._label + _nodes[n]._label_length != _nodes[child]._label)
+      {
+        // the two labels aren't next to each other in the buffer (they are if the edge was split before)
+        std::string joined (label (n));
+        joined += label (child);
+        assert (_labels.size () + joined.size () <= std::numeric_limits<uint32_t>::max ());
+        _nodes[n]._label = static_cast<uint32_t> (_labels.size ());
+        _labels += joined; // the old copies are dead now, compact_labels gets rid of them eventually
+      }
+
+    _nodes[n]._label_length += _nodes[child]._label_length;
+    _nodes[n]._finished = _nodes[child]._finished;
+    release_block (n);
+    _nodes[n]._children = _nodes[child]._children;
+    _nodes[n]._child_count = _nodes[child]._child_count;
+    _nodes[n]._child_capacity = _nodes[child]._child_capacity;
+    _nodes[child]._child_capacity = 0; // the block now belongs to n
+    _nodes[child]._label_length = 0;   // and so do its label bytes
+    free_node (child);
+  }
+
+  // copies every live label into a fresh buffer, dropping what splits and merges left behind
+  void
+  compact_labels ()
+  {
+    std::string labels;
+    labels.reserve (_live_label_bytes);
+    std::stack<uint32_t> pending;
+    pending.push (root);
+
+    while (! pending.empty ())
+      {
+        auto n = pending.top ();
+
+        pending.pop ();
+        auto offset = static_cast<uint32_t> (labels.size ());
+        labels += label (n);
+        _nodes[n]._label = offset;
+
+        for (uint32_t i = 0; i < _nodes[n]._child_count; ++i)
+          {
+            pending.push (children (n)[i]);
+          }
+      }
+
+    _labels = std::move (labels);
+  }
+
+  // node the key ends in, with edge_rest = how much of that node's label is left past the end of the key
+  uint32_t
+  walk (std::string_view key, size_t& edge_rest) const
+  {
+    auto n = root;
+    edge_rest = 0;
+
+    while (! key.empty ())
+      {
+        auto slot = find_child (n, key[0]);
+
+        if (slot == npos)
+          {
+            return null;
+          }
+
+        n = children (n)[slot];
+        auto edge = label (n);
+        auto common = common_prefix (edge, key);
+
+        if (common < key.size () && common < edge.size ())
+          {
+            return null;
+          }
+
+        edge_rest = edge.size () - common;
+        key.remove_prefix (common);
+      }
+
+    return n;
+  }
+
+  void
+  collect (uint32_t n, std::string& word, std::vector<std::string>& words) const
+  {
+    std::stack<std::pair<uint32_t, size_t>> pending; // node and the word length before its label
+    pending.emplace (n, word.size ());
+    bool first {true};
+
+    while (! pending.empty ())
+      {
+        auto [current, length] = pending.top ();
+
+        pending.pop ();
+
+        if (first)
+          {
+            first = false; // the caller already put n's label in the word
+          }
+        else
+          {
+            word.resize (length);
+            word += label (current);
+          }
+
+        if (_nodes[current]._finished)
+          {
+            words.emplace_back (word);
+          }
+
+        for (auto i = _nodes[current]._child_count; i > 0; --i)
+          {
+            pending.emplace (children (current)[i - 1], word.size ());
+          }
+      }
+  }
+
+  std::vector<node> _nodes;
+  std::vector<uint32_t> _free_nodes;
+  std::string _labels;
+  size_t _live_label_bytes {0};
+  std::vector<uint32_t> _blocks; // children blocks: sorted first label bytes, then the matching node indices
+  std::array<std::vector<uint32_t>, 9> _free_blocks; // released block offsets, by size class (1 .. 256)
+};
+
+//
+// a-z trie where every key carries a score and every node caches the best `top` completions under it,
+// best first. a query is a walk down the prefix plus a read of that list, no subtree traversal. keeping
+// the lists right on writes is a walk back up the key's path: a better score just gets slotted into each
+// list on the way, a worse score or a removal rebuilds each list on the path from its children's lists
+// (which are already right, we go bottom up) and the node's own key
+//
+template <uint32_t top = 10>
+class autocomplete_trie final
+{
+public:
+  struct completion final
+  {
+    std::string_view _key; // valid until the next insert/remove
+    uint64_t _score;
+  };
+
+  autocomplete_trie ()
+    : _nodes (1)
+  {}
+
+  // adds key or changes its score. keys that are empty or have anything but a-z in them are ignored,
+  // checked before the walk so a bad key never leaves half a path behind
+  void
+  insert (std::string_view key, uint64_t score)
+  {
+    if (key.empty ()
+        || ! std::all_of (key.begin (), key.end (), [] (char l) {
+             return static_cast<uint32_t> (static_cast<unsigned char> (l) - 'a') < alphabet_size;
+           }))
+      {
+        return;
+      }
+
+    auto& path = _path;
+    path.assign (1, root);
+
+    for (auto const& l : key)
+      {
+        uint32_t child = static_cast<unsigned char> (l) - 'a';
+
+        if (_nodes[path.back ()]._children[child] == null)
+          {
+            auto fresh = new_node (); // may grow _nodes, don't hold references across it
+            _nodes[path.back ()]._children[child] = fresh;
+          }
+
+        path.push_back (_nodes[path.back ()]._children[child]);
+      }
+
+    auto& terminal = _nodes[path.back ()];
+    bool better {true};
+
+    if (terminal._key == null)
+      {
+        terminal._key = new_key (key, score);
+      }
+    else
+      {
+        better = score >= _keys[terminal._key]._score;
+        _keys[terminal._key]._score = score;
+      }
+
+    if (better)
+      {
+        for (auto n : path)
+          {
+            raise (_nodes[n], terminal._key);
+          }
+      }
+    else
+      {
+        for (auto it = path.rbegin (); it != path.rend (); ++it)
+          {
+            rebuild (*it);
+          }
+      }
+  }
+
+  bool
+  remove (std::string_view key)
+  {
+    auto& path = _path;
+    path.assign (1, root);
+
+    for (auto const& l : key)
+      {
+        uint32_t child = static_cast<unsigned char> (l) - 'a';
+
+        if (child >= alphabet_size || _nodes[path.back ()]._children[child] == null)
+          {
+            return false;
+          }
+
+        path.push_back (_nodes[path.back ()]._children[child]);
+      }
+
+    auto& terminal = _nodes[path.back ()];
+
+    if (key.empty () || terminal._key == null)
+      {
+        return false;
+      }
+
+    _keys[terminal._key] = key_entry {};
+    _free_keys.push_back (terminal._key);
+    terminal._key = null;
+
+    // bottom up: drop nodes that are left with nothing under them, rebuild the lists of the rest
+    for (auto d = path.size () - 1; d > 0; --d)
+      {
+        auto& n = _nodes[path[d]];
+
+        if (n._key == null && is_leaf (n))
+          {
+            _nodes[path[d - 1]]._children[static_cast<unsigned char> (key[d - 1]) - 'a'] = null;
+            n = node {};
+            _free_nodes.push_back (path[d]);
+          }
+        else
+          {
+            rebuild (path[d]);
+          }
+      }
+
+    rebuild (root);
+
+    return true;
+  }
+
+  // best completions of prefix, best first, at most `top` of them
+  std::vector<completion>
+  top_completions (std::string_view prefix) const
+  {
+    std::vector<completion> result;
+    uint32_t n {root};
+
+    for (auto const& l : prefix)
+      {
+        uint32_t child = static_cast<unsigned char> (l) - 'a';
+
+        if (child >= alphabet_size || _nodes[n]._children[child] == null)
+          {
+            return result;
+          }
+
+        n = _nodes[n]._children[child];
+      }
+
+    auto const& best = _nodes[n];
+
+    for (uint32_t i = 0; i < best._top_count; ++i)
+      {
+        auto const& k = _keys[best._top[i]];
+        result.push_back ({k._key, k._score});
+      }
+
+    return result;
+  }
+
+  bool
+  empty () const
+  {
+    return _nodes[root]._top_count == 0;
+  }
+
+private:
+  static uint32_t constexpr alphabet_size {26};
+  static uint32_t constexpr root {0};
+  static uint32_t constexpr null {0}; // for both nodes and keys, key 0 is a dummy that's never handed out
+
+  struct key_entry final
+  {
+    std::string _key;
+    uint64_t _score {0};
+  };
+
+  struct node final
+  {
+    node ()
+    {
+      _children.fill (null);
+    }
+
+    std::array<uint32_t, alphabet_size> _children;
+    uint32_t _key {null};
+    uint32_t _top_count {0};
+    std::array<uint32_t, top> _top; // key ids, best first
+  };
+
+  // score first, ties go to the lower key id so results are stable. ids are recycled through _free_keys,
+  // so that isn't insertion order once keys have been removed
+  bool
+  ahead (uint32_t a, uint32_t b) const
+  {
+    return _keys[a]._score != _keys[b]._score ? _keys[a]._score > _keys[b]._score : a < b;
+  }
+
+  static bool
+  is_leaf (node const& n)
+  {
+    for (auto c : n._children)
+      {
+        if (c != null)
+          {
+            return false;
+          }
+      }
+
+    return true;
+  }
+
+  uint32_t
+  new_node ()
+  {
+    if (! _free_nodes.empty ())
+      {
+        auto n = _free_nodes.back ();
+        _free_nodes.pop_back ();
+        return n;
+      }
+
+    _nodes.emplace_back ();
+
+    return static_cast<uint32_t> (_nodes.size () - 1);
+  }
+
+  uint32_t
+  new_key (std::string_view key, uint64_t score)
+  {
+    if (_keys.empty ())
+      {
+        _keys.emplace_back (); // the dummy
+      }
+
+    if (! _free_keys.empty ())
+      {
+        auto k = _free_keys.back ();
+        _free_keys.pop_back ();
+        _keys[k] = key_entry {std::string (key), score};
+        return k;
+      }
+
+    _keys.push_back (key_entry {std::string (key), score});
+
+    return static_cast<uint32_t> (_keys.size () - 1);
+  }
+
+  // k's score went up (or k is new): it can only move up in any list, or push the last one out
+  void
+  raise (node& n, uint32_t k)
+  {
+    uint32_t i {0};
+
+    for (; i < n._top_count && n._top[i] != k; ++i)
+      ;
+
+    if (i == n._top_count)
+      {
+        if (n._top_count < top)
+          {
+            ++n._top_count;
+          }
+        else if (ahead (n._top[top - 1], k))
+          {
+            return;
+          }
+
+        i = n._top_count - 1;
+      }
+
+    for (; i > 0 && ahead (k, n._top[i - 1]); --i)
+      {
+        n._top[i] = n._top[i - 1];
+      }
+
+    n._top[i] = k;
+  }
+
+  // the subtree's best is among the node's own key and its children's lists
+  void
+  rebuild (uint32_t index)
+  {
+    auto& n = _nodes[index];
+    n._top_count = 0;
+
+    if (n._key != null)
+      {
+        raise (n, n._key);
+      }
+
+    for (auto c : n._children)
+      {
+        if (c == null)
+          {
+            continue;
+          }
+
+        auto const& child = _nodes[c];
+
+        for (uint32_t i = 0; i < child._top_count; ++i)
+          {
+            if (n._top_count == top && ahead (n._top[top - 1], child._top[i]))
+              {
+                break; // the child's list is sorted, nothing further down it makes the cut either
+              }
+
+            raise (n, child._top[i]);
+          }
+      }
+  }
+
+  std::vector<node> _nodes;
+  std::vector<key_entry> _keys;
+  std::vector<uint32_t> _free_nodes;
+  std::vector<uint32_t> _free_keys;
+  std::vector<uint32_t> _path; // scratch for insert/remove
+};
+
+//
+// a-z trie for many readers and one writer at a time, rcu style. published nodes are never modified:
+// insert/remove copy the nodes along the key's path, link the copies up and swap the root pointer in one
+// atomic store, so a reader sees either the old trie or the new one and never takes a lock. the replaced
+// nodes can't be freed straight away since a reader may still be walking them, so they are retired with
+// the current epoch and freed once every reader that was active back then has finished (epoch based
+// reclamation). writers serialise on a mutex, readers only touch their own announcement slot. there are
+// twice as many slots as hardware threads (at least 64), readers beyond that wait for one to free up,
+// yielding between scans
+//
+class concurrent_trie final
+{
+public:
+  concurrent_trie ()
+    : _root {new node ()},
+      _readers (std::max (min_reader_slots, 2 * std::thread::hardware_concurrency ()))
+  {}
+
+  concurrent_trie (concurrent_trie const&) = delete;
+  concurrent_trie& operator= (concurrent_trie const&) = delete;
+
+  ~concurrent_trie ()
+  {
+    std::stack<node const*> nodes;
+    nodes.push (_root.load ());
+
+    while (! nodes.empty ())
+      {
+        auto* c = nodes.top ();
+
+        nodes.pop ();
+
+        for (auto* p : c->_children)
+          {
+            if (p != nullptr)
+              {
+                nodes.push (p);
+              }
+          }
+
+        delete c;
+      }
+
+    for (auto& [_, retired] : _retired)
+      {
+        for (auto* n : retired)
+          {
+            delete n;
+          }
+      }
+  }
+
+  // keys with anything but a-z in them are ignored, like empty ones
+  void
+  insert (std::string const& key)
+  {
+    if (! valid_key (key) || contains_key (key))
+      {
+        return;
+      }
+
+    std::lock_guard lock (_writer);
+    std::vector<node const*> old_path;
+    auto copies = copy_path (key, old_path);
+    copies.back ()->_finished = true;
+    publish (copies, old_path);
+  }
+
+  bool
+  remove (std::string const& key)
+  {
+    if (! valid_key (key))
+      {
+        return false;
+      }
+
+    std::lock_guard lock (_writer);
+
+    if (! contains_key (key))
+      {
+        return false;
+      }
+
+    std::vector<node const*> old_path;
+    auto copies = copy_path (key, old_path);
+    copies.back ()->_finished = false;
+
+    // prune copies that end up holding nothing, bottom up, the root always stays
+    for (auto d = copies.size () - 1; d > 0 && ! copies[d]->_finished && is_leaf (copies[d]); --d)
+      {
+        copies[d - 1]->_children[static_cast<unsigned char> (key[d - 1]) - 'a'] = nullptr;
+        delete copies[d];
+        copies.pop_back ();
+      }
+
+    publish (copies, old_path);
+
+    return true;
+  }
+
+  bool
+  contains_key (std::string const& key) const
+  {
+    if (key.empty ())
+      {
+        return false;
+      }
+
+    read_guard guard (*this);
+    auto const* n = walk (key);
+
+    return n != nullptr && n->_finished;
+  }
+
+  bool
+  contains_prefix (std::string const& prefix) const
+  {
+    if (prefix.empty ())
+      {
+        return false;
+      }
+
+    read_guard guard (*this);
+    auto const* n = walk (prefix);
+
+    return n != nullptr;
+  }
+
+  bool
+  empty () const
+  {
+    read_guard guard (*this);
+
+    return is_leaf (_root.load ());
+  }
+
+  // retired nodes not freed yet, handy to check reclamation keeps up
+  size_t
+  pending_reclaim () const
+  {
+    std::lock_guard lock (_writer);
+    size_t total {0};
+
+    for (auto const& [_, retired] : _retired)
+      {
+        total += retired.size ();
+      }
+
+    return total;
+  }
+
+private:
+  static uint32_t constexpr alphabet_size {26};
+  static uint32_t constexpr min_reader_slots {64};
+  static uint64_t constexpr idle {0};
+
+  struct node final
+  {
+    bool _finished {false};
+    std::array<node const*, alphabet_size> _children {};
+  };
+
+  // one cache line per slot so readers don't fight over announcements
+  struct alignas (64) reader_slot final
+  {
+    std::atomic<uint64_t> _epoch {idle};
+  };
+
+  // announces the epoch a reader started in for as long as it's looking at nodes. grabs any idle slot,
+  // starting from the one this thread used last time so it's usually the first try, and yields after a
+  // full scan comes up empty rather than spinning on a core another reader could use
+  class read_guard final
+  {
+  public:
+    explicit read_guard (concurrent_trie const& t)
+    {
+      static thread_local uint32_t hint {0};
+      auto slots = static_cast<uint32_t> (t._readers.size ());
+      auto start = hint % slots;
+
+      for (uint32_t i = start;;)
+        {
+          auto expected = idle;
+
+          // seq_cst: the announcement has to be visible before we load the root
+          if (t._readers[i]._epoch.compare_exchange_weak (expected, t._epoch.load ()))
+            {
+              _slot = &t._readers[i];
+              hint = i;
+              return;
+            }
+
+          i = (i + 1) % slots;
+
+          if (i == start)
+            {
+              std::this_thread::yield ();
+            }
+        }
+    }
+
+    ~read_guard ()
+    {
+      _slot->_epoch.store (idle, std::memory_order_release);
+    }
+
+    read_guard (read_guard const&) = delete;
+    read_guard& operator= (read_guard const&) = delete;
+
+  private:
+    reader_slot* _slot;
+  };
+
+  static bool
+  is_leaf (node const* n)
+  {
+    for (auto* p : n->_children)
+      {
+        if (p != nullptr)
+          {
+            return false;
+          }
+      }
+
+    return true;
+  }
+
+  // non-empty and a-z only, writers check this before copy_path indexes _children with the key
+  static bool
+  valid_key (std::string const& key)
+  {
+    return ! key.empty () && std::all_of (key.begin (), key.end (), [] (char l) {
+      return static_cast<uint32_t> (static_cast<unsigned char> (l) - 'a') < alphabet_size;
+    });
+  }
+
+  node const*
+  walk (std::string const& key) const
+  {
+    auto const* n = _root.load ();
+
+    for (auto const& l : key)
+      {
+        uint32_t child = static_cast<unsigned char> (l) - 'a';
+
+        if (child >= alphabet_size || n->_children[child] == nullptr)
+          {
+            return nullptr;
+          }
+
+        n = n->_children[child];
+      }
+
+    return n;
+  }
+
+  // fresh copies of root and every node on key's path (new empty nodes where the path runs out), already
+  // linked to each other; old_path gets the nodes they replace
+  std::vector<node*>
+  copy_path (std::string const& key, std::vector<node const*>& old_path) const
+  {
+    std::vector<node*> copies;
+    node const* n = _root.load ();
+    copies.push_back (new node (*n));
+    old_path.push_back (n);
+
+    for (auto const& l : key)
+      {
+        uint32_t child = static_cast<unsigned char> (l) - 'a';
+        assert (child < alphabet_size); // insert and remove only get here with valid_key keys
+        n = n == nullptr ? nullptr : n->_children[child];
+        copies.push_back (n == nullptr ? new node () : new node (*n));
+        copies[copies.size () - 2]->_children[child] = copies.back ();
+
+        if (n != nullptr)
+          {
+            old_path.push_back (n);
+          }
+      }
+
+    return copies;
+  }
+
+  void
+  publish (std::vector<node*> const& copies, std::vector<node const*>& old_path)
+  {
+    _root.store (copies[0]);
+    // anybody announcing the new epoch loaded the root after the store above, so only readers still
+    // on an epoch <= retired_in can be looking at old_path
+    auto retired_in = _epoch.fetch_add (1);
+    _retired.emplace_back (retired_in, std::move (old_path));
+    reclaim ();
+  }
+
+  void
+  reclaim ()
+  {
+    auto oldest = std::numeric_limits<uint64_t>::max ();
+
+    for (auto const& r : _readers)
+      {
+        auto e = r._epoch.load ();
+
+        if (e != idle)
+          {
+            oldest = std::min (oldest, e);
+          }
+      }
+
+    while (! _retired.empty () && _retired.front ().first < oldest)
+      {
+        for (auto* n : _retired.front ().second)
+          {
+            delete n;
+          }
+
+        _retired.pop_front ();
+      }
+  }
+
+  std::atomic<node const*> _root;
+  mutable std::atomic<uint64_t> _epoch {1};
+  mutable std::vector<reader_slot> _readers;
+  mutable std::mutex _writer;
+  std::deque<std::pair<uint64_t, std::vector<node const*>>> _retired;
+};
+
+// word list for the benchmarks: the system dictionary if there is one (lowercase a-z words only, that's all
+// trie can take), otherwise made up words with a roughly english looking letter distribution
+static std::vector<std::string>
+load_words ()
+{
+  std::vector<std::string> words;
+  std::ifstream in ("/usr/share/dict/words");
+
+  for (std::string line; std::getline (in, line);)
+    {
+      if (! line.empty () && std::all_of (line.begin (), line.end (), [] (char c) { return c >= 'a' && c <= 'z'; }))
+        {
+          words.emplace_back (line);
+        }
+    }
+
+  if (! words.empty ())
+    {
+      return words;
+    }
+
+  static char const* const syllables[] {"an", "re", "st", "in", "ed", "er", "on", "tion", "al", "ing", "pre",
+                                        "un", "ly", "ment", "ca", "ro", "li", "ness", "de", "co"};
+  uint32_t x {2463534242u};
+
+  for (uint32_t i = 0; i < 200'000; ++i)
+    {
+      std::string word;
+
+      for (uint32_t n = 2 + i % 4, j = 0; j < n; ++j)
+        {
+          x ^= x << 13;
+          x ^= x >> 17;
+          x ^= x << 5;
+          word += syllables[x % 20];
+        }
+
+      words.emplace_back (word);
+    }
+
+  return words;
+}
+
+static std::vector<std::string>
+make_urls (size_t n)
+{
+  static char const* const hosts[] {"https://example.com", "https://api.example.com", "http://cdn.example.org"};
+  static char const* const paths[] {"/users/", "/posts/", "/static/img/", "/v2/orders/"};
+  std::vector<std::string> urls;
+  uint32_t x {88172645u};
+
+  for (size_t i = 0; i < n; ++i)
+    {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      urls.emplace_back (std::string (hosts[x % 3]) + paths[(x >> 8) % 4] + std::to_string (x % 1'000'000)
+                         + "/Index.HTML");
+    }
+
+  return urls;
+}
+
+template <typename Trie, typename Keys>
+static void
+bench_trie (char const* name, Keys const& keys)
+{
+  Trie t;
+  auto start = std::chrono::high_resolution_clock::now ();
+
+  for (auto const& key : keys)
+    {
+      t.insert (key);
+    }
+
+  auto mid = std::chrono::high_resolution_clock::now ();
+  size_t found {0};
+
+  for (auto const& key : keys)
+    {
+      found += t.contains_key (key);
+    }
+
+  auto end = std::chrono::high_resolution_clock::now ();
+  assert (found == keys.size ());
+  std::cout << name << ": insert " << std::chrono::duration_cast<std::chrono::microseconds> (mid - start).count ()
+            << "us, lookup " << std::chrono::duration_cast<std::chrono::microseconds> (end - mid).count () << "us ("
+            << found << " of " << keys.size () << " keys found)\n";
+}
+
+// queries drawn from a zipf distribution (s = 1) over the words, cut down to 1-4 letter prefixes the
+// way a user types them, against scores that are zipf by rank as well
+static void
+bench_autocomplete (std::vector<std::string> const& words)
+{
+  static size_t constexpr queries {200'000};
+  autocomplete_trie<10> t;
+
+  for (size_t i = 0; i < words.size (); ++i)
+    {
+      t.insert (words[i], 1'000'000'000 / (i + 1));
+    }
+
+  std::vector<double> cdf (words.size ());
+  double total {0};
+
+  for (size_t i = 0; i < words.size (); ++i)
+    {
+      total += 1.0 / (i + 1);
+      cdf[i] = total;
+    }
+
+  std::vector<std::string_view> prefixes (queries);
+  uint64_t x {0x2545f4914f6cdd1dull};
+
+  for (auto& prefix : prefixes)
+    {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      auto u = static_cast<double> (x >> 11) / (1ull << 53) * total;
+      auto const& word = words[std::lower_bound (cdf.begin (), cdf.end (), u) - cdf.begin ()];
+      prefix = std::string_view (word).substr (0, 1 + x % 4);
+    }
+
+  std::vector<int64_t> latencies (queries);
+  size_t results {0};
+
+  for (size_t i = 0; i < queries; ++i)
+    {
+      auto start = std::chrono::high_resolution_clock::now ();
+      results += t.top_completions (prefixes[i]).size ();
+      auto end = std::chrono::high_resolution_clock::now ();
+      latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count ();
+    }
+
+  std::sort (latencies.begin (), latencies.end ());
+  int64_t sum {0};
+
+  for (auto l : latencies)
+    {
+      sum += l;
+    }
+
+  assert (results > 0);
+  std::cout << "autocomplete top 10: avg " << sum / static_cast<int64_t> (queries) << "ns, p50 "
+            << latencies[queries / 2] << "ns, p99 " << latencies[queries * 99 / 100] << "ns, " << results
+            << " completions\n";
+}
+
+// readers hammering contains_key while one writer keeps inserting and removing, from 1 reader up to
+// every hardware thread. reader throughput should scale since readers never lock or write shared lines
+static void
+bench_concurrent_trie (std::vector<std::string> const& words)
+{
+  static size_t constexpr lookups_per_reader {200'000};
+  concurrent_trie t;
+
+  for (size_t i = 0; i < words.size (); i += 2)
+    {
+      t.insert (words[i]);
+    }
+
+  auto max_readers = std::max (1u, std::thread::hardware_concurrency ());
+
+  for (uint32_t readers = 1;; readers = std::min (readers * 2, max_readers))
+    {
+      std::atomic<bool> stop {false};
+      std::thread writer ([&t, &words, &stop] {
+        for (size_t i = 1; ! stop.load (std::memory_order_relaxed); i = (i + 2) % words.size ())
+          {
+            t.insert (words[i]);
+            t.remove (words[i]);
+          }
+      });
+      std::vector<std::thread> pool;
+      std::atomic<size_t> total_found {0};
+      auto start = std::chrono::high_resolution_clock::now ();
+
+      for (uint32_t r = 0; r < readers; ++r)
+        {
+          pool.emplace_back ([&t, &words, &total_found, r] {
+            size_t found {0};
+
+            for (size_t i = 0; i < lookups_per_reader; ++i)
+              {
+                found += t.contains_key (words[(i * 7919 + r) % words.size ()]);
+              }
+
+            total_found += found;
+          });
+        }
+
+      for (auto& thread : pool)
+        {
+          thread.join ();
+        }
+
+      auto end = std::chrono::high_resolution_clock::now ();
+      stop = true;
+      writer.join ();
+      auto us = std::chrono::duration_cast<std::chrono::microseconds> (end - start).count ();
+      std::cout << "concurrent_trie, " << readers << " reader(s) + 1 writer: "
+                << static_cast<double> (readers * lookups_per_reader) / std::max<int64_t> (us, 1) << " lookups/us, "
+                << total_found << " found\n";
+
+      if (readers == max_readers)
+        {
+          break;
+        }
+    }
+}
+
+// a "document" worth of tokens checked one contains_key at a time vs in one contains_keys call
+static void
+bench_batched_contains (std::vector<std::string> const& words)
+{
+  static size_t constexpr tokens {1'000'000};
+  trie t;
+
+  for (size_t i = 0; i < words.size (); i += 2)
+    {
+      t.insert (words[i]);
+    }
+
+  std::vector<std::string_view> document (tokens);
+  uint32_t x {2463534242u};
+
+  for (auto& token : document)
+    {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      token = words[x % words.size ()];
+    }
+
+  // contains_key wants std::string, both runs read the tokens from the same copies so it's a fair fight
+  std::vector<std::string> owned (document.begin (), document.end ());
+  document.assign (owned.begin (), owned.end ());
+  size_t single {0};
+  auto start = std::chrono::high_resolution_clock::now ();
+
+  for (auto const& token : owned)
+    {
+      single += t.contains_key (token);
+    }
+
+  auto mid = std::chrono::high_resolution_clock::now ();
+  std::vector<bool> found;
+  t.contains_keys (document.data (), document.size (), found);
+  auto end = std::chrono::high_resolution_clock::now ();
+  auto batched = static_cast<size_t> (std::count (found.begin (), found.end (), true));
+  assert (batched == single);
+  auto single_us = std::chrono::duration_cast<std::chrono::microseconds> (mid - start).count ();
+  auto batched_us = std::chrono::duration_cast<std::chrono::microseconds> (end - mid).count ();
+  std::cout << "trie lookups, one by one: " << single_us << "us (" << single << " found), batched: " << batched_us
+            << "us (" << batched << " found)\n";
+}
+
+int
+main ()
+{
+  using namespace std::string_literals;
+
+  trie t;
+
+  // Test inserting and searching for single characters
+  t.insert ("a"s);
+  t.insert ("b"s);
+  assert (t.contains_key ("a"s));
+  assert (t.contains_key ("b"s));
+  assert (! t.contains_key ("c"s));
+
+  // Test inserting and searching for overlapping words
+  t.insert ("apple"s);
+  t.insert ("app"s);
+  assert (t.contains_key ("apple"s));
+  assert (t.contains_key ("app"s));
+  assert (t.contains_prefix ("ap"s));
+  assert (!t.contains_key ("ap"s));
+
+  // Test removing non-existent words
+  t.remove ("banana"s); // Should not affect the trie
+  assert (t.contains_key ("apple"s));
+  assert (t.contains_key ("app"s));
+
+  // Test removing words with shared prefixes
+  t.remove ("app"s);
+  assert (! t.contains_key ("app"s));
+  assert (t.contains_key ("apple"s)); // "apple" should still exist
+
+  // Test edge cases
+  t.insert (""s); // Insert empty string
+  assert (! t.contains_key (""s)); // Should not be found
+
+  t.insert ("test"s);
+  t.remove ("test"s);
+  t.remove ("test"s); // Remove twice
+  assert(! t.contains_key("test"s));
 
   // Additional complex cases
   t.insert ("trie"s);
@@ -355,7 +2179,259 @@ main ()
   assert (shared[0] == "imstupid"s);
   assert (shared[1] == "imnot"s);
 
+  // frozen copy answers exactly like the trie it came from
+  auto frozen = t3.freeze ();
+  assert (frozen.contains_key ("imstupid"s));
+  assert (frozen.contains_key ("mybest"s));
+  assert (! frozen.contains_key ("im"s));
+  assert (! frozen.contains_key ("IM"s));
+  assert (frozen.contains_prefix ("im"s));
+  assert (frozen.contains_prefix ("sma"s));
+  assert (! frozen.contains_prefix ("x"s));
+  assert (frozen.get_words_with_shared_prefix ("im"s) == shared);
+  assert (frozen.memory_usage () * 10 < t3.memory_usage ());
+
+  auto frozen_t = t.freeze ();
+  assert (frozen_t.contains_key ("trigger"s));
+  assert (frozen_t.contains_key ("apple"s));
+  assert (! frozen_t.contains_key ("trie"s));
+  assert (! frozen_t.contains_key ("app"s));
+  assert (frozen_t.contains_key ("a"s));
+
+  trie t4;
+  assert (t4.freeze ().empty ());
+
+  // streaming enumeration: every completion, lexicographic, can stop early
+  trie t6;
+  for (auto const& w : {"apple"s, "app"s, "apply"s, "ape"s, "banana"s, "applesauce"s, "b"s})
+    {
+      t6.insert (w);
+    }
+  std::vector<std::string> seen;
+  trie::walk_scratch scratch;
+  t6.for_each_word_with_prefix ("ap", [&seen] (std::string_view w) { seen.emplace_back (w); return true; }, scratch);
+  assert ((seen == std::vector {"ape"s, "app"s, "apple"s, "applesauce"s, "apply"s}));
+  assert ((t6.get_first_words_with_prefix ("app", 2) == std::vector {"app"s, "apple"s}));
+  assert ((t6.get_first_words_with_prefix ("", 3) == std::vector {"ape"s, "app"s, "apple"s}));
+  assert ((t6.get_first_words_with_prefix ("b", 10) == std::vector {"b"s, "banana"s}));
+  assert (t6.get_first_words_with_prefix ("c", 10).empty ());
+  assert (t6.get_first_words_with_prefix ("A", 10).empty ());
+
+  // removed nodes get recycled instead of piling up
+  trie t5;
+  t5.insert ("abcdef"s);
+  t5.remove ("abcdef"s);
+  t5.insert ("abcdef"s);
+  auto before = t5.memory_usage ();
+  for (int i = 0; i < 100; ++i)
+    {
+      assert (t5.remove ("abcdef"s));
+      t5.insert ("abcdef"s);
+    }
+  assert (t5.memory_usage () == before);
+  assert (t5.contains_key ("abcdef"s));
+
+  // batched lookups agree with one at a time ones
+  std::vector<std::string_view> tokens {"apple", "app", "", "ape", "apples", "b", "banana", "bandana", "APP",
+                                        "applesauce", "x", "apply", "ap"};
+  std::vector<bool> found;
+  t6.contains_keys (tokens.data (), tokens.size (), found);
+  assert (found.size () == tokens.size ());
+  for (size_t i = 0; i < tokens.size (); ++i)
+    {
+      assert (found[i] == (! tokens[i].empty () && tokens[i] != "APP" && t6.contains_key (std::string (tokens[i]))));
+    }
+
+  // radix trie: arbitrary bytes and compressed edges
+  radix_trie r;
+  r.insert ("romane"s);
+  r.insert ("romanus"s);
+  r.insert ("romulus"s);
+  r.insert ("rubens"s);
+  r.insert ("ruber"s);
+  r.insert ("rubicon"s);
+  r.insert ("rubicundus"s);
+  r.insert ("https://Example.com/a?b=1"s);
+  r.insert ("rom"s);
+  assert (r.contains_key ("romane"s));
+  assert (r.contains_key ("rom"s));
+  assert (r.contains_key ("https://Example.com/a?b=1"s));
+  assert (! r.contains_key ("ro"s));
+  assert (! r.contains_key ("romanes"s));
+  assert (! r.contains_key ("https://Example.com"s));
+  assert (r.contains_prefix ("rubic"s));
+  assert (r.contains_prefix ("https://Ex"s));
+  assert (! r.contains_prefix ("rubx"s));
+  assert ((r.get_words_with_shared_prefix ("rub"s) == std::vector {"rubens"s, "ruber"s, "rubicon"s, "rubicundus"s}));
+  assert ((r.get_words_with_shared_prefix ("ro"s) == std::vector {"rom"s, "romane"s, "romanus"s, "romulus"s}));
+  assert ((r.get_words_with_shared_prefix ("romu"s) == std::vector {"romulus"s}));
+  assert (r.remove ("rom"s));
+  assert (! r.remove ("rom"s));
+  assert (! r.remove ("ro"s));
+  assert (r.contains_key ("romane"s));
+  assert (r.remove ("romane"s));
+  assert (r.remove ("romanus"s));
+  assert (r.contains_key ("romulus"s));
+  assert (! r.contains_prefix ("roma"s));
+  assert (r.remove ("romulus"s));
+  assert (r.remove ("rubens"s) && r.remove ("ruber"s) && r.remove ("rubicon"s) && r.remove ("rubicundus"s));
+  assert (r.remove ("https://Example.com/a?b=1"s));
+  assert (r.empty ());
+  {
+    // random churn over every byte value against std::set: fills a 256 wide root block, reuses freed
+    // nodes and blocks, and removes enough to make the label buffer compact itself
+    std::set<std::string> reference;
+    uint32_t x {88172645u};
+    auto next = [&x] {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      return x;
+    };
+
+    for (int round = 0; round < 20'000; ++round)
+      {
+        std::string key (1 + next () % 6, '\0');
+
+        for (auto& c : key)
+          {
+            c = static_cast<char> (next () % 4 == 0 ? next () % 256 : 'a' + next () % 3);
+          }
+
+        if (next () % 3 == 0)
+          {
+            assert (r.remove (key) == (reference.erase (key) == 1));
+          }
+        else
+          {
+            r.insert (key);
+            reference.insert (key);
+          }
+      }
+
+    for (auto const& key : reference)
+      {
+        assert (r.contains_key (key));
+      }
+
+    assert ((r.get_words_with_shared_prefix ("a"s)
+             == std::vector<std::string> (reference.lower_bound ("a"s), reference.lower_bound ("b"s))));
+
+    for (auto const& key : reference)
+      {
+        assert (r.remove (key));
+      }
+
+    assert (r.empty ());
+  }
+
+  // scored autocomplete, lists kept right through raises, drops and removals
+  autocomplete_trie<2> ac;
+  ac.insert ("car"s, 10);
+  ac.insert ("cat"s, 30);
+  ac.insert ("cart"s, 20);
+  ac.insert ("dog"s, 5);
+  auto best = ac.top_completions ("ca"s);
+  assert (best.size () == 2 && best[0]._key == "cat"s && best[1]._key == "cart"s);
+  ac.insert ("car"s, 40);
+  best = ac.top_completions ("c"s);
+  assert (best.size () == 2 && best[0]._key == "car"s && best[0]._score == 40 && best[1]._key == "cat"s);
+  ac.insert ("car"s, 1);
+  best = ac.top_completions ("car"s);
+  assert (best.size () == 2 && best[0]._key == "cart"s && best[1]._key == "car"s);
+  best = ac.top_completions (""s);
+  assert (best.size () == 2 && best[0]._key == "cat"s && best[1]._key == "cart"s);
+  assert (ac.remove ("cat"s));
+  assert (! ac.remove ("cat"s));
+  assert (! ac.remove ("ca"s));
+  best = ac.top_completions ("ca"s);
+  assert (best.size () == 2 && best[0]._key == "cart"s && best[1]._key == "car"s);
+  assert (ac.top_completions ("cat"s).empty ());
+  assert (ac.remove ("cart"s) && ac.remove ("car"s) && ac.remove ("dog"s));
+  assert (ac.empty ());
+  assert (ac.top_completions ("c"s).empty ());
+  ac.insert ("Car"s, 7);
+  ac.insert ("caf\xc3\xa9"s, 7);
+  ac.insert (""s, 7);
+  assert (ac.empty ());
+  assert (ac.top_completions ("ca"s).empty ());
+
+  // rcu trie: same answers as trie, readers racing a writer never see a half done update
+  concurrent_trie ct;
+  ct.insert ("app"s);
+  ct.insert ("apple"s);
+  ct.insert ("banana"s);
+  assert (ct.contains_key ("app"s) && ct.contains_key ("apple"s));
+  assert (ct.contains_prefix ("ban"s));
+  assert (! ct.contains_key ("ap"s));
+  assert (ct.remove ("apple"s));
+  assert (! ct.remove ("apple"s));
+  assert (ct.contains_key ("app"s) && ! ct.contains_key ("apple"s) && ! ct.contains_prefix ("appl"s));
+  assert (ct.remove ("app"s) && ct.remove ("banana"s));
+  ct.insert ("App"s);
+  ct.insert ("caf\xc3\xa9"s);
+  assert (! ct.remove ("App"s));
+  assert (ct.empty ());
+  assert (ct.pending_reclaim () == 0);
+  {
+    std::atomic<bool> done {false};
+    ct.insert ("stab"s);
+    std::thread writer ([&ct, &done] {
+      for (int i = 0; i < 2'000; ++i)
+        {
+          ct.insert ("stablemate"s);
+          ct.remove ("stablemate"s);
+          ct.remove ("stable"s);
+          ct.insert ("stable"s);
+        }
+      done = true;
+    });
+    std::thread reader ([&ct, &done] {
+      while (! done)
+        {
+          // whichever version of the trie we land on, "stab" is in it
+          assert (ct.contains_key ("stab"s));
+        }
+    });
+    writer.join ();
+    reader.join ();
+    assert (ct.contains_key ("stab"s) && ct.contains_key ("stable"s) && ! ct.contains_key ("stablemate"s));
+    ct.insert ("x"s); // no readers left, so this write frees everything retired before it
+    assert (ct.pending_reclaim () == 0);
+  }
+  {
+    // more readers than announcement slots, the extra ones have to wait their turn instead of failing
+    auto readers = 4 * std::max (64u, 2 * std::thread::hardware_concurrency ());
+    std::atomic<size_t> found {0};
+    std::vector<std::thread> pool;
+
+    for (uint32_t r = 0; r < readers; ++r)
+      {
+        pool.emplace_back ([&ct, &found] {
+          for (int i = 0; i < 100; ++i)
+            {
+              found += ct.contains_key ("stab"s);
+            }
+        });
+      }
+
+    for (auto& thread : pool)
+      {
+        thread.join ();
+      }
+
+    assert (found == readers * 100);
+  }
+
   std::cout << "All test passed!\n";
 
+  auto words = load_words ();
+  bench_trie<trie> ("trie, words", words);
+  bench_trie<radix_trie> ("radix_trie, words", words);
+  bench_trie<radix_trie> ("radix_trie, urls", make_urls (100'000));
+  bench_autocomplete (words);
+  bench_concurrent_trie (words);
+  bench_batched_contains (words);
+
   return 0;
 }